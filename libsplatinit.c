@@ -0,0 +1,2103 @@
+//
+// Created by Alex Flores Escarcega on 3/10/24.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <float.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <stdalign.h>
+#include <sys/mman.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SPLATINIT_X86 1
+#include <immintrin.h>
+#endif
+
+#include "splatinit.h"
+
+#define FLAT 0
+#define GLOBAL_SCALE 1
+
+static const char* PLAY_CANVAS_PLY_HEADER = "ply\n"
+                                     "format binary_little_endian 1.0\n"
+                                     "element vertex %0*d\n"
+                                     "property float x\n"
+                                     "property float y\n"
+                                     "property float z\n"
+                                     "property float f_dc_0\n"
+                                     "property float f_dc_1\n"
+                                     "property float f_dc_2\n"
+                                     "property float opacity\n"
+                                     "property float rot_0\n"
+                                     "property float rot_1\n"
+                                     "property float rot_2\n"
+                                     "property float rot_3\n"
+                                     "property float scale_0\n"
+                                     "property float scale_1\n"
+                                     "property float scale_2\n"
+                                     "end_header\n";
+
+// The same vertices with every field but the position in half precision, 34 bytes each
+static const char* PLAY_CANVAS_HALF_PLY_HEADER = "ply\n"
+                                          "format binary_little_endian 1.0\n"
+                                          "element vertex %0*d\n"
+                                          "property float x\n"
+                                          "property float y\n"
+                                          "property float z\n"
+                                          "property half f_dc_0\n"
+                                          "property half f_dc_1\n"
+                                          "property half f_dc_2\n"
+                                          "property half opacity\n"
+                                          "property half rot_0\n"
+                                          "property half rot_1\n"
+                                          "property half rot_2\n"
+                                          "property half rot_3\n"
+                                          "property half scale_0\n"
+                                          "property half scale_1\n"
+                                          "property half scale_2\n"
+                                          "end_header\n";
+
+// The compressed PLY of PlayCanvas and SuperSplat. Splats are quantized in chunks against the bounds of
+// their chunk: 11-10-11 bit positions and scales, the three smallest components of the rotation in 10 bits
+// each, and 8-bit colors with the opacity as alpha.
+static const char* COMPRESSED_PLY_HEADER = "ply\n"
+                                    "format binary_little_endian 1.0\n"
+                                    "element chunk %d\n"
+                                    "property float min_x\n"
+                                    "property float min_y\n"
+                                    "property float min_z\n"
+                                    "property float max_x\n"
+                                    "property float max_y\n"
+                                    "property float max_z\n"
+                                    "property float min_scale_x\n"
+                                    "property float min_scale_y\n"
+                                    "property float min_scale_z\n"
+                                    "property float max_scale_x\n"
+                                    "property float max_scale_y\n"
+                                    "property float max_scale_z\n"
+                                    "element vertex %d\n"
+                                    "property uint packed_position\n"
+                                    "property uint packed_rotation\n"
+                                    "property uint packed_scale\n"
+                                    "property uint packed_color\n"
+                                    "end_header\n";
+
+#define COMPRESSED_CHUNK_SPLATS 256
+#define COMPRESSED_CHUNK_FLOATS 12
+
+static const float C0 = 0.28209479177387814f;
+
+// Number of floats in a splat; Splat is only made of floats, so its fields can be walked as an array
+#define SPLAT_FLOATS (int)(sizeof(Splat) / sizeof(float))
+
+// Every generated splat is opaque and has the same rotation, and coalescing only changes its scale, so
+// these fields are not stored with the splats and only filled in when they are interleaved
+static const float SPLAT_OPACITY = 1.0f;
+static const float SPLAT_ROTATION[4] = {1.0f, 1.0f, 0.0f, 0.0f};
+// Scale of a splat covering a single pixel
+static const float SPLAT_SCALE = 0.1f;
+// SPLAT_ROTATION is a quarter turn about x, so a splat's second scale spans the depth axis z and its
+// third the y axis of the image
+#define SCALE_X 0
+#define SCALE_DEPTH 1
+#define SCALE_Y 2
+
+// Number of arrays of SplatArrays: position, color and scale, 9 of the 14 floats of a Splat
+#define SPLAT_ARRAYS 9
+
+// Structure of arrays the splats are generated and coalesced in, one array per stored float of a Splat.
+// Scanning one attribute, like the colors the coalescers compare, only touches that attribute's array.
+// Splats are interleaved into Splat records only when they are written.
+typedef union {
+    struct {
+        float* position[3];
+        float* color[3];
+        float* scale[3];
+    };
+    float* fields[SPLAT_ARRAYS];
+} SplatArrays;
+
+// Which arrays are stored. Without coalescing every pixel becomes one splat in raster order, so its
+// position follows from its index on the pixel grid and its scale is the constant one; only the colors,
+// and the depths when there is a depth map, are stored then. The arrays left out are NULL, are not
+// generated, and are filled in when the splats are interleaved.
+typedef enum {
+    SPLAT_LAYOUT_FULL,
+    SPLAT_LAYOUT_GRID,      // Colors only, at depth 0
+    SPLAT_LAYOUT_GRID_DEPTH // Colors and depths
+} SplatLayout;
+
+static int splat_array_stored(SplatLayout layout, int field) {
+    int color = field >= 3 && field < 6;
+    int depth = field == 2;
+    return layout == SPLAT_LAYOUT_FULL || color || (layout == SPLAT_LAYOUT_GRID_DEPTH && depth);
+}
+
+// Allocates capacity splats as one block holding the stored arrays back to back
+static int splat_arrays_alloc(SplatArrays* arrays, int capacity, SplatLayout layout) {
+    int num_stored = 0;
+    for (int f = 0; f < SPLAT_ARRAYS; f++) {
+        num_stored += splat_array_stored(layout, f);
+    }
+    float* block = (float*)malloc((size_t)capacity * num_stored * sizeof(float));
+    float* next = block;
+    for (int f = 0; f < SPLAT_ARRAYS; f++) {
+        arrays->fields[f] = block && splat_array_stored(layout, f) ? next : NULL;
+        next += arrays->fields[f] ? capacity : 0;
+    }
+    return block ? 0 : -1;
+}
+
+// The block starts with the first stored array
+static void splat_arrays_free(SplatArrays* arrays) {
+    for (int f = 0; f < SPLAT_ARRAYS; f++) {
+        if (arrays->fields[f]) {
+            free(arrays->fields[f]);
+            return;
+        }
+    }
+}
+
+// View of the arrays starting at splat offset
+static SplatArrays splat_arrays_at(const SplatArrays* arrays, int offset) {
+    SplatArrays view;
+    for (int f = 0; f < SPLAT_ARRAYS; f++) {
+        view.fields[f] = arrays->fields[f] ? &arrays->fields[f][offset] : NULL;
+    }
+    return view;
+}
+
+static void splat_arrays_load(const SplatArrays* arrays, int index, Splat* splat) {
+    for (int a = 0; a < 3; a++) {
+        splat->packed_position[a] = arrays->position[a][index];
+        splat->packed_color[a] = arrays->color[a][index];
+        splat->packed_scale[a] = arrays->scale[a][index];
+    }
+    splat->opacity = SPLAT_OPACITY;
+    memcpy(splat->packed_rotation, SPLAT_ROTATION, sizeof(SPLAT_ROTATION));
+}
+
+// Only the stored fields are kept; the splat's opacity and rotation are the constant ones
+static void splat_arrays_store(SplatArrays* arrays, int index, const Splat* splat) {
+    for (int a = 0; a < 3; a++) {
+        arrays->position[a][index] = splat->packed_position[a];
+        arrays->color[a][index] = splat->packed_color[a];
+        arrays->scale[a][index] = splat->packed_scale[a];
+    }
+}
+
+// Moves count splats starting at from[from_index] to arrays[index]; the ranges may overlap
+static void splat_arrays_move(SplatArrays* arrays, int index, const SplatArrays* from, int from_index, int count) {
+    for (int f = 0; f < SPLAT_ARRAYS; f++) {
+        memmove(&arrays->fields[f][index], &from->fields[f][from_index], count * sizeof(float));
+    }
+}
+
+// Interleaves count splats starting at arrays[index] into Splat records
+static void splat_arrays_interleave(const SplatArrays* arrays, int index, int count, Splat* splats) {
+    for (int i = 0; i < count; i++) {
+        splat_arrays_load(arrays, index + i, &splats[i]);
+    }
+}
+
+// Where the splats of a grid layout sit in the image: splat i of the arrays is the pixel i past the first
+// pixel of row row_begin
+typedef struct {
+    int width;
+    int row_begin;
+} SplatGrid;
+
+// Same for a grid layout, filling in the positions and scales from a template splat that steps along the
+// pixel grid, one whole record at a time
+static void splat_grid_interleave(const SplatArrays* arrays, const SplatGrid* grid, int index, int count,
+                                  Splat* splats) {
+    Splat splat;
+    long long pixel = (long long)grid->row_begin * grid->width + index;
+    int x = (int)(pixel % grid->width);
+    splat.packed_position[1] = (float)(pixel / grid->width);
+    splat.packed_position[2] = 0.0f;
+    splat.opacity = SPLAT_OPACITY;
+    memcpy(splat.packed_rotation, SPLAT_ROTATION, sizeof(SPLAT_ROTATION));
+    for (int a = 0; a < 3; a++) {
+        splat.packed_scale[a] = SPLAT_SCALE;
+    }
+
+    const float* depths = arrays->position[2];
+    for (int i = 0; i < count; i++) {
+        splat.packed_position[0] = (float)x;
+        if (depths) {
+            splat.packed_position[2] = depths[index + i];
+        }
+        for (int c = 0; c < 3; c++) {
+            splat.packed_color[c] = arrays->color[c][index + i];
+        }
+        splats[i] = splat;
+        if (++x == grid->width) {
+            x = 0;
+            splat.packed_position[1] += 1.0f;
+        }
+    }
+}
+
+static void rgb2_sh(float rgb[3], float sh[3]) {
+    for (int i = 0; i < 3; i++) {
+        sh[i] = (rgb[i] - 0.5f) / C0;
+    }
+}
+
+static double wall_time_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// Converts num_pixels 8-bit RGB pixels into their SH DC colors, one array per channel
+typedef void (*RgbToShKernel)(const unsigned char* rgb, float* const sh[3], int num_pixels);
+
+// The per-pixel conversion through rgb2_sh()
+static void rgb_to_sh_scalar(const unsigned char* rgb, float* const sh[3], int num_pixels) {
+    for (int i = 0; i < num_pixels; i++) {
+        float color[3];
+        float color_sh[3];
+        for (int c = 0; c < 3; c++) {
+            color[c] = rgb[i * 3 + c] / 255.0f;
+        }
+        rgb2_sh(color, color_sh);
+        for (int c = 0; c < 3; c++) {
+            sh[c][i] = color_sh[c];
+        }
+    }
+}
+
+#ifdef SPLATINIT_X86
+// The vector kernels fold the conversion into a single multiply-add, v * scale + bias, and deinterleave
+// the channels on the way out. The pixels left over after the last full block are run through one more
+// block from a zero padded copy, so every pixel of a row goes through exactly the same arithmetic and
+// equal bytes always give equal floats.
+#define SSE2_BLOCK_PIXELS 16
+
+static void rgb_to_sh_sse2_block(const unsigned char* rgb, float* r, float* g, float* b) {
+    const __m128 scale = _mm_set1_ps(1.0f / (255.0f * C0));
+    const __m128 bias = _mm_set1_ps(-0.5f / C0);
+    const __m128i zero = _mm_setzero_si128();
+    __m128 v[12];
+
+    for (int i = 0; i < 3; i++) {
+        __m128i bytes = _mm_loadu_si128((const __m128i*)&rgb[i * 16]);
+        __m128i low = _mm_unpacklo_epi8(bytes, zero);
+        __m128i high = _mm_unpackhi_epi8(bytes, zero);
+        v[i * 4 + 0] = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(low, zero)), scale), bias);
+        v[i * 4 + 1] = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(low, zero)), scale), bias);
+        v[i * 4 + 2] = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(high, zero)), scale), bias);
+        v[i * 4 + 3] = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(high, zero)), scale), bias);
+    }
+
+    // Every three vectors hold four pixels as r0 g0 b0 r1 | g1 b1 r2 g2 | b2 r3 g3 b3
+    for (int p = 0; p < 4; p++) {
+        __m128 x0 = v[p * 3 + 0];
+        __m128 x1 = v[p * 3 + 1];
+        __m128 x2 = v[p * 3 + 2];
+        __m128 red = _mm_shuffle_ps(x0, _mm_shuffle_ps(x1, x2, _MM_SHUFFLE(1, 1, 2, 2)), _MM_SHUFFLE(2, 0, 3, 0));
+        __m128 green = _mm_shuffle_ps(_mm_shuffle_ps(x0, x1, _MM_SHUFFLE(0, 0, 1, 1)),
+                                      _mm_shuffle_ps(x1, x2, _MM_SHUFFLE(2, 2, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0));
+        __m128 blue = _mm_shuffle_ps(_mm_shuffle_ps(x0, x1, _MM_SHUFFLE(1, 1, 2, 2)),
+                                     _mm_shuffle_ps(x2, x2, _MM_SHUFFLE(3, 3, 0, 0)), _MM_SHUFFLE(2, 0, 2, 0));
+        _mm_storeu_ps(&r[p * 4], red);
+        _mm_storeu_ps(&g[p * 4], green);
+        _mm_storeu_ps(&b[p * 4], blue);
+    }
+}
+
+static void rgb_to_sh_sse2(const unsigned char* rgb, float* const sh[3], int num_pixels) {
+    int i = 0;
+    for (; i + SSE2_BLOCK_PIXELS <= num_pixels; i += SSE2_BLOCK_PIXELS) {
+        rgb_to_sh_sse2_block(&rgb[i * 3], &sh[0][i], &sh[1][i], &sh[2][i]);
+    }
+    if (i < num_pixels) {
+        unsigned char padded[SSE2_BLOCK_PIXELS * 3] = {0};
+        float padded_sh[3][SSE2_BLOCK_PIXELS];
+        int remaining = num_pixels - i;
+        memcpy(padded, &rgb[i * 3], remaining * 3);
+        rgb_to_sh_sse2_block(padded, padded_sh[0], padded_sh[1], padded_sh[2]);
+        for (int c = 0; c < 3; c++) {
+            memcpy(&sh[c][i], padded_sh[c], remaining * sizeof(float));
+        }
+    }
+}
+
+#define AVX2_BLOCK_PIXELS 8
+// A block reads 4 bytes past its last pixel
+#define AVX2_BLOCK_BYTES_READ 28
+
+__attribute__((target("avx2")))
+static void rgb_to_sh_avx2_block(const unsigned char* rgb, float* r, float* g, float* b) {
+    const __m256 scale = _mm256_set1_ps(1.0f / (255.0f * C0));
+    const __m256 bias = _mm256_set1_ps(-0.5f / C0);
+    const __m128i gather_channels = _mm_setr_epi8(0, 3, 6, 9, 1, 4, 7, 10, 2, 5, 8, 11, -1, -1, -1, -1);
+
+    // Pixels 0-3 and 4-7 each become rrrr gggg bbbb
+    __m128i first = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)&rgb[0]), gather_channels);
+    __m128i second = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)&rgb[12]), gather_channels);
+    __m128i red_green = _mm_unpacklo_epi32(first, second);
+    __m128i blue = _mm_unpackhi_epi32(first, second);
+
+    __m256 red_values = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(red_green));
+    __m256 green_values = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_srli_si128(red_green, 8)));
+    __m256 blue_values = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(blue));
+    _mm256_storeu_ps(r, _mm256_add_ps(_mm256_mul_ps(red_values, scale), bias));
+    _mm256_storeu_ps(g, _mm256_add_ps(_mm256_mul_ps(green_values, scale), bias));
+    _mm256_storeu_ps(b, _mm256_add_ps(_mm256_mul_ps(blue_values, scale), bias));
+}
+
+__attribute__((target("avx2")))
+static void rgb_to_sh_avx2(const unsigned char* rgb, float* const sh[3], int num_pixels) {
+    int i = 0;
+    for (; i * 3 + AVX2_BLOCK_BYTES_READ <= num_pixels * 3; i += AVX2_BLOCK_PIXELS) {
+        rgb_to_sh_avx2_block(&rgb[i * 3], &sh[0][i], &sh[1][i], &sh[2][i]);
+    }
+    if (i < num_pixels) {
+        // Fewer than two blocks are left
+        unsigned char padded[AVX2_BLOCK_PIXELS * 6 + 4] = {0};
+        float padded_sh[3][AVX2_BLOCK_PIXELS * 2];
+        int remaining = num_pixels - i;
+        memcpy(padded, &rgb[i * 3], remaining * 3);
+        for (int j = 0; j < remaining; j += AVX2_BLOCK_PIXELS) {
+            rgb_to_sh_avx2_block(&padded[j * 3], &padded_sh[0][j], &padded_sh[1][j], &padded_sh[2][j]);
+        }
+        for (int c = 0; c < 3; c++) {
+            memcpy(&sh[c][i], padded_sh[c], remaining * sizeof(float));
+        }
+    }
+}
+#endif
+
+// SH DC color of every byte value. On x86 the table is filled by the SSE2 kernel, so the table lookup and
+// the vector kernels give bit identical colors and can be swapped freely.
+static float RGB_TO_SH_LUT[256];
+
+static void init_rgb_to_sh_lut() {
+    unsigned char bytes[256 * 3];
+    float colors[3][256];
+    float* const sh[3] = {colors[0], colors[1], colors[2]};
+    for (int i = 0; i < 256 * 3; i++) {
+        bytes[i] = (unsigned char)(i / 3);
+    }
+#ifdef SPLATINIT_X86
+    rgb_to_sh_sse2(bytes, sh, 256);
+#else
+    rgb_to_sh_scalar(bytes, sh, 256);
+#endif
+    memcpy(RGB_TO_SH_LUT, colors[0], sizeof(RGB_TO_SH_LUT));
+}
+
+static void rgb_to_sh_lut(const unsigned char* rgb, float* const sh[3], int num_pixels) {
+    float* r = sh[0];
+    float* g = sh[1];
+    float* b = sh[2];
+    for (int i = 0; i < num_pixels; i++) {
+        r[i] = RGB_TO_SH_LUT[rgb[i * 3 + 0]];
+        g[i] = RGB_TO_SH_LUT[rgb[i * 3 + 1]];
+        b[i] = RGB_TO_SH_LUT[rgb[i * 3 + 2]];
+    }
+}
+
+typedef struct {
+    const char* name;
+    RgbToShKernel kernel;
+} RgbToShKernelInfo;
+
+static const RgbToShKernelInfo RGB_TO_SH_KERNELS[] = {
+        {"scalar", rgb_to_sh_scalar},
+        {"lut", rgb_to_sh_lut},
+#ifdef SPLATINIT_X86
+        {"sse2", rgb_to_sh_sse2},
+        {"avx2", rgb_to_sh_avx2},
+#endif
+};
+#define NUM_RGB_TO_SH_KERNELS (int)(sizeof(RGB_TO_SH_KERNELS) / sizeof(RGB_TO_SH_KERNELS[0]))
+
+static int rgb_to_sh_kernel_supported(const char* name) {
+#ifdef SPLATINIT_X86
+    if (strcmp(name, "avx2") == 0) {
+        return __builtin_cpu_supports("avx2");
+    }
+#endif
+    return 1;
+}
+
+// Pixels and passes the fastest kernel is picked with, well under a millisecond per kernel
+#define KERNEL_CALIBRATION_PIXELS (1 << 15)
+#define KERNEL_CALIBRATION_PASSES 4
+
+// Times the supported kernels on a synthetic row and returns the fastest. Only kernels that agree bit for
+// bit with the lookup table are candidates, so which one wins never changes the output.
+static const RgbToShKernelInfo* fastest_rgb_to_sh_kernel() {
+    unsigned char* rgb = (unsigned char*)malloc(KERNEL_CALIBRATION_PIXELS * 3);
+    float* expected = (float*)malloc(KERNEL_CALIBRATION_PIXELS * 3 * sizeof(float));
+    float* colors = (float*)malloc(KERNEL_CALIBRATION_PIXELS * 3 * sizeof(float));
+    const RgbToShKernelInfo* fastest = NULL;
+    double fastest_seconds = 0.0;
+    if (!rgb || !expected || !colors) {
+        free(rgb);
+        free(expected);
+        free(colors);
+        return NULL;
+    }
+    float* const expected_sh[3] = {expected, &expected[KERNEL_CALIBRATION_PIXELS], &expected[KERNEL_CALIBRATION_PIXELS * 2]};
+    float* const colors_sh[3] = {colors, &colors[KERNEL_CALIBRATION_PIXELS], &colors[KERNEL_CALIBRATION_PIXELS * 2]};
+
+    unsigned int seed = 12345;
+    for (int i = 0; i < KERNEL_CALIBRATION_PIXELS * 3; i++) {
+        seed = seed * 1103515245u + 12345u;
+        rgb[i] = (unsigned char)(seed >> 16);
+    }
+    rgb_to_sh_lut(rgb, expected_sh, KERNEL_CALIBRATION_PIXELS);
+
+    for (int k = 0; k < NUM_RGB_TO_SH_KERNELS; k++) {
+        const RgbToShKernelInfo* info = &RGB_TO_SH_KERNELS[k];
+        if (!rgb_to_sh_kernel_supported(info->name)) {
+            continue;
+        }
+        info->kernel(rgb, colors_sh, KERNEL_CALIBRATION_PIXELS);
+        if (memcmp(colors, expected, KERNEL_CALIBRATION_PIXELS * 3 * sizeof(float)) != 0) {
+            continue;
+        }
+
+        double best = 0.0;
+        for (int pass = 0; pass < KERNEL_CALIBRATION_PASSES; pass++) {
+            double start = wall_time_seconds();
+            info->kernel(rgb, colors_sh, KERNEL_CALIBRATION_PIXELS);
+            double seconds = wall_time_seconds() - start;
+            best = pass == 0 || seconds < best ? seconds : best;
+        }
+        if (!fastest || best < fastest_seconds) {
+            fastest = info;
+            fastest_seconds = best;
+        }
+    }
+
+    free(rgb);
+    free(expected);
+    free(colors);
+    return fastest;
+}
+
+static pthread_once_t rgb_to_sh_lut_once = PTHREAD_ONCE_INIT;
+static pthread_once_t fastest_rgb_to_sh_kernel_once = PTHREAD_ONCE_INIT;
+static const RgbToShKernelInfo* fastest_kernel;
+
+static void init_fastest_rgb_to_sh_kernel(void) {
+    fastest_kernel = fastest_rgb_to_sh_kernel();
+}
+
+// Looks up a kernel by name; "auto" picks the fastest one on this CPU, timed once per process. Returns NULL
+// for unknown or unsupported kernels.
+static const RgbToShKernelInfo* select_rgb_to_sh_kernel(const char* name) {
+    pthread_once(&rgb_to_sh_lut_once, init_rgb_to_sh_lut);
+    if (strcmp(name, "auto") == 0) {
+        pthread_once(&fastest_rgb_to_sh_kernel_once, init_fastest_rgb_to_sh_kernel);
+        return fastest_kernel;
+    }
+    for (int i = 0; i < NUM_RGB_TO_SH_KERNELS; i++) {
+        if (strcmp(name, RGB_TO_SH_KERNELS[i].name) == 0 && rgb_to_sh_kernel_supported(name)) {
+            return &RGB_TO_SH_KERNELS[i];
+        }
+    }
+    return NULL;
+}
+
+// The frame a conversion reads. A delta conversion also sets the previous frame, and only the pixels that
+// differ from it are emitted.
+typedef struct {
+    const unsigned char* image_data;
+    const void* depth_data;                   // NULL without a depth map
+    const unsigned char* previous_image_data; // NULL unless converting a delta
+    const void* previous_depth_data;          // Compared only when both frames have a depth map
+    DepthFormat depth_format;                 // Of both depth maps
+    int width;
+    int height;
+} SplatSource;
+
+typedef struct {
+    SplatArrays splats;     // Destination of the first row of the buffer, which holds image row splat_row
+    unsigned char* changed; // Same for the changed flags of a delta conversion
+    int splat_row;
+    const SplatSource* source;
+    RgbToShKernel kernel;
+    int row_begin;
+    int row_end;
+} SplatRowBand;
+
+// Flags the pixels of row y whose color or depth differ from the previous frame
+static void flag_changed_pixels(const SplatSource* source, int y, unsigned char* changed) {
+    int width = source->width;
+    const unsigned char* pixels = &source->image_data[(size_t)y * width * 3];
+    const unsigned char* previous_pixels = &source->previous_image_data[(size_t)y * width * 3];
+    for (int x = 0; x < width; x++) {
+        changed[x] = pixels[x * 3] != previous_pixels[x * 3] || pixels[x * 3 + 1] != previous_pixels[x * 3 + 1] ||
+                     pixels[x * 3 + 2] != previous_pixels[x * 3 + 2];
+    }
+    if (!source->depth_data || !source->previous_depth_data) {
+        return;
+    }
+    size_t offset = (size_t)y * width;
+    if (source->depth_format == DEPTH_U16) {
+        const uint16_t* depths = (const uint16_t*)source->depth_data + offset;
+        const uint16_t* previous_depths = (const uint16_t*)source->previous_depth_data + offset;
+        for (int x = 0; x < width; x++) {
+            changed[x] |= depths[x] != previous_depths[x];
+        }
+    } else if (source->depth_format == DEPTH_F32) {
+        const float* depths = (const float*)source->depth_data + offset;
+        const float* previous_depths = (const float*)source->previous_depth_data + offset;
+        for (int x = 0; x < width; x++) {
+            changed[x] |= depths[x] != previous_depths[x];
+        }
+    } else {
+        const unsigned char* depths = (const unsigned char*)source->depth_data + offset;
+        const unsigned char* previous_depths = (const unsigned char*)source->previous_depth_data + offset;
+        for (int x = 0; x < width; x++) {
+            changed[x] |= depths[x] != previous_depths[x];
+        }
+    }
+}
+
+// Converts count depth samples from offset on into depth units: 8-bit samples and floats as they are,
+// 16-bit samples scaled to the 8-bit range so either depth map of a scene yields the same geometry
+static void load_depths(const void* depth_data, DepthFormat format, size_t offset, int count, float* depths) {
+    if (format == DEPTH_U16) {
+        const uint16_t* samples = (const uint16_t*)depth_data + offset;
+        for (int x = 0; x < count; x++) {
+            depths[x] = samples[x] * (255.0f / 65535.0f);
+        }
+    } else if (format == DEPTH_F32) {
+        memcpy(depths, (const float*)depth_data + offset, count * sizeof(float));
+    } else {
+        const unsigned char* samples = (const unsigned char*)depth_data + offset;
+        for (int x = 0; x < count; x++) {
+            depths[x] = samples[x];
+        }
+    }
+}
+
+static void generate_splat_rows(const SplatRowBand* band) {
+    const unsigned char* image_data = band->source->image_data;
+    const void* depth_data = band->source->depth_data;
+    int width = band->source->width;
+
+    for (int y = band->row_begin; y < band->row_end; y++) {
+        SplatArrays row = splat_arrays_at(&band->splats, (y - band->splat_row) * width);
+        if (band->changed) {
+            flag_changed_pixels(band->source, y, &band->changed[(y - band->splat_row) * width]);
+        }
+        band->kernel(&image_data[y * width * 3], row.color, width);
+        if (depth_data && row.position[2]) {
+            load_depths(depth_data, band->source->depth_format, (size_t)y * width, width, row.position[2]);
+        }
+        // The rest is implicit in a grid layout
+        if (!row.position[0]) {
+            continue;
+        }
+
+        for (int x = 0; x < width; x++) {
+            row.position[0][x] = (float)x;
+            row.position[1][x] = (float)y;
+        }
+        if (!depth_data) {
+            for (int x = 0; x < width; x++) {
+                row.position[2][x] = FLAT ? 0.0f : 0.0f;
+            }
+        }
+        for (int x = 0; x < width; x++) {
+            row.scale[0][x] = SPLAT_SCALE;
+            row.scale[1][x] = SPLAT_SCALE;
+            row.scale[2][x] = SPLAT_SCALE;
+        }
+    }
+}
+
+static void* generate_splat_rows_worker(void* arg) {
+    generate_splat_rows((const SplatRowBand*)arg);
+    return NULL;
+}
+
+// Fills splats with image rows [row_begin, row_end) in disjoint row bands, one band per thread. Every
+// pixel only writes its own splat, so the bands never share a cache line except at their boundaries.
+// changed receives the changed flags of a delta conversion and is NULL otherwise.
+static void generate_splats(SplatArrays* splats, unsigned char* changed, const SplatSource* source, int row_begin,
+                            int row_end, RgbToShKernel kernel, int num_threads) {
+    int num_rows = row_end - row_begin;
+    if (num_threads > num_rows) {
+        num_threads = num_rows;
+    }
+    if (num_threads < 1) {
+        num_threads = 1;
+    }
+
+    SplatRowBand* bands = (SplatRowBand*)malloc(num_threads * sizeof(SplatRowBand));
+    pthread_t* threads = (pthread_t*)malloc(num_threads * sizeof(pthread_t));
+    int* started = (int*)calloc(num_threads, sizeof(int));
+
+    for (int t = 0; t < num_threads; t++) {
+        bands[t].splats = *splats;
+        bands[t].changed = changed;
+        bands[t].splat_row = row_begin;
+        bands[t].source = source;
+        bands[t].kernel = kernel;
+        bands[t].row_begin = row_begin + (int)((long long)num_rows * t / num_threads);
+        bands[t].row_end = row_begin + (int)((long long)num_rows * (t + 1) / num_threads);
+    }
+
+    // The calling thread takes the first band itself; if a thread cannot be spawned its band is run inline
+    for (int t = 1; t < num_threads; t++) {
+        started[t] = pthread_create(&threads[t], NULL, generate_splat_rows_worker, &bands[t]) == 0;
+    }
+    generate_splat_rows(&bands[0]);
+    for (int t = 1; t < num_threads; t++) {
+        if (started[t]) {
+            pthread_join(threads[t], NULL);
+        } else {
+            generate_splat_rows(&bands[t]);
+        }
+    }
+
+    free(started);
+    free(threads);
+    free(bands);
+}
+
+#define PLY_HEADER_CAPACITY 4096
+
+// Copies the formatted header text into header, which holds PLY_HEADER_CAPACITY bytes, with every line
+// of comments, which may be NULL, as a comment line between the format line and the first element, as far
+// as they fit
+static int splice_header_comments(char* header, const char* text, int text_length, const char* comments) {
+    int format_length = (int)(strstr(text, "element ") - text);
+    int length = format_length;
+    memcpy(header, text, format_length);
+    while (comments && *comments) {
+        int line_length = (int)strcspn(comments, "\n");
+        if (length + line_length + 9 + text_length - format_length >= PLY_HEADER_CAPACITY) {
+            break;
+        }
+        length += sprintf(&header[length], "comment %.*s\n", line_length, comments);
+        comments += line_length + (comments[line_length] == '\n');
+    }
+    memcpy(&header[length], &text[format_length], text_length - format_length + 1);
+    return length + text_length - format_length;
+}
+
+// Formats the PLY header for num_splats vertices of the precision into header. A non-zero count_digits zero
+// pads the vertex count to that many digits so the header can be rewritten in place once the final count
+// is known.
+static int format_play_canvas_header(char* header, int num_splats, SplatPrecision precision, int count_digits,
+                                     const char* comments) {
+    char text[1024];
+    int text_length = sprintf(text, precision == PRECISION_HALF ? PLAY_CANVAS_HALF_PLY_HEADER : PLAY_CANVAS_PLY_HEADER,
+                              count_digits, num_splats);
+    return splice_header_comments(header, text, text_length, comments);
+}
+
+static int format_compressed_header(char* header, int num_chunks, int num_splats, const char* comments) {
+    char text[1024];
+    int text_length = sprintf(text, COMPRESSED_PLY_HEADER, num_chunks, num_splats);
+    return splice_header_comments(header, text, text_length, comments);
+}
+
+// Splats are interleaved into a chunk of this many splats so the output is written with a handful of
+// large fwrite calls instead of one call per splat
+#define WRITE_CHUNK_SPLATS (1 << 16)
+
+// Where the splats of an image are moved on their way out: unprojected through the camera into camera
+// space, then into the world by the camera's pose
+typedef struct {
+    int unproject;
+    CameraIntrinsics camera;
+    int posed;
+    CameraPose pose;
+    float pose_quaternion[4]; // The pose's rotation, composed with every splat's rotation
+} SplatTransform;
+
+typedef struct {
+    const SplatinitSink* sink;
+    Splat* mapped; // When set, splats are interleaved straight into this mapping instead of the sink
+    Splat* chunk;
+    const SplatTransform* transform; // When set, splats are transformed as they are interleaved
+    SplatGrid grid;                  // Of the arrays appended, when they have a grid layout
+    int staged;
+    long long written;
+    int failed;
+} SplatWriter;
+
+// Resolves the transform of the options for a width x height image, centering the principal point where
+// it is not given. Returns whether splats are transformed at all.
+static int resolve_transform(const SplatinitOptions* options, int width, int height, SplatTransform* transform) {
+    transform->camera = options->camera;
+    transform->camera.cx = isnan(options->camera.cx) ? width / 2.0f : options->camera.cx;
+    transform->camera.cy = isnan(options->camera.cy) ? height / 2.0f : options->camera.cy;
+    transform->unproject = options->camera.fx > 0.0f && options->camera.fy > 0.0f;
+    transform->posed = options->pose != NULL;
+    if (transform->posed) {
+        const float (*m)[3] = options->pose->rotation;
+        float* q = transform->pose_quaternion;
+        transform->pose = *options->pose;
+        // Rotation matrix to (w, x, y, z) quaternion, branching on the largest diagonal term for precision
+        float trace = m[0][0] + m[1][1] + m[2][2];
+        if (trace > 0.0f) {
+            float s = 0.5f / sqrtf(trace + 1.0f);
+            q[0] = 0.25f / s;
+            q[1] = (m[2][1] - m[1][2]) * s;
+            q[2] = (m[0][2] - m[2][0]) * s;
+            q[3] = (m[1][0] - m[0][1]) * s;
+        } else if (m[0][0] > m[1][1] && m[0][0] > m[2][2]) {
+            float s = 2.0f * sqrtf(1.0f + m[0][0] - m[1][1] - m[2][2]);
+            q[0] = (m[2][1] - m[1][2]) / s;
+            q[1] = 0.25f * s;
+            q[2] = (m[0][1] + m[1][0]) / s;
+            q[3] = (m[0][2] + m[2][0]) / s;
+        } else if (m[1][1] > m[2][2]) {
+            float s = 2.0f * sqrtf(1.0f + m[1][1] - m[0][0] - m[2][2]);
+            q[0] = (m[0][2] - m[2][0]) / s;
+            q[1] = (m[0][1] + m[1][0]) / s;
+            q[2] = 0.25f * s;
+            q[3] = (m[1][2] + m[2][1]) / s;
+        } else {
+            float s = 2.0f * sqrtf(1.0f + m[2][2] - m[0][0] - m[1][1]);
+            q[0] = (m[1][0] - m[0][1]) / s;
+            q[1] = (m[0][2] + m[2][0]) / s;
+            q[2] = (m[1][2] + m[2][1]) / s;
+            q[3] = 0.25f * s;
+        }
+    }
+    return transform->unproject || transform->posed;
+}
+
+// Moves count splats from pixel coordinates and depth into camera space, where a splat's footprint scales
+// with its depth like the pixels it covers do, and from there into the world. The scales are logarithmic,
+// so the footprint is scaled by adding the log of the depth over the focal length. Coalesced splats are
+// transformed from their centers, so this runs on the interleaved splats, while they are still in cache,
+// rather than on the arrays.
+static void transform_splats(Splat* splats, int count, const SplatTransform* transform) {
+    const CameraIntrinsics* camera = &transform->camera;
+    float inverse_fx = 1.0f / camera->fx;
+    float inverse_fy = 1.0f / camera->fy;
+    for (int i = 0; transform->unproject && i < count; i++) {
+        float* position = splats[i].packed_position;
+        float* scale = splats[i].packed_scale;
+        float x_per_pixel = position[2] * inverse_fx;
+        float y_per_pixel = position[2] * inverse_fy;
+        position[0] = (position[0] - camera->cx) * x_per_pixel;
+        position[1] = (position[1] - camera->cy) * y_per_pixel;
+        // Scales are logarithmic; a zero depth keeps a finite, vanishing scale. The splat is as thick along z
+        // as it is wide, so it stays in camera units on every axis.
+        float x_log = logf(fmaxf(fabsf(x_per_pixel), FLT_MIN));
+        scale[SCALE_X] += x_log;
+        scale[SCALE_Y] += logf(fmaxf(fabsf(y_per_pixel), FLT_MIN));
+        scale[SCALE_DEPTH] += x_log;
+    }
+
+    const float (*m)[3] = transform->pose.rotation;
+    const float* t = transform->pose.translation;
+    const float* q = transform->pose_quaternion;
+    for (int i = 0; transform->posed && i < count; i++) {
+        float* position = splats[i].packed_position;
+        float* rotation = splats[i].packed_rotation;
+        float p[3] = {position[0], position[1], position[2]};
+        float r[4] = {rotation[0], rotation[1], rotation[2], rotation[3]};
+        for (int row = 0; row < 3; row++) {
+            position[row] = m[row][0] * p[0] + m[row][1] * p[1] + m[row][2] * p[2] + t[row];
+        }
+        rotation[0] = q[0] * r[0] - q[1] * r[1] - q[2] * r[2] - q[3] * r[3];
+        rotation[1] = q[0] * r[1] + q[1] * r[0] + q[2] * r[3] - q[3] * r[2];
+        rotation[2] = q[0] * r[2] - q[1] * r[3] + q[2] * r[0] + q[3] * r[1];
+        rotation[3] = q[0] * r[3] + q[1] * r[2] - q[2] * r[1] + q[3] * r[0];
+    }
+}
+
+// chunk holds WRITE_CHUNK_SPLATS splats and is owned by the caller
+static void splat_writer_init(SplatWriter* writer, const SplatinitSink* sink, Splat* chunk) {
+    writer->sink = sink;
+    writer->mapped = NULL;
+    writer->transform = NULL;
+    writer->grid = (SplatGrid){0, 0};
+    writer->chunk = chunk;
+    writer->staged = 0;
+    writer->written = 0;
+    writer->failed = 0;
+}
+
+static void splat_writer_init_mapped(SplatWriter* writer, Splat* mapped) {
+    writer->sink = NULL;
+    writer->mapped = mapped;
+    writer->chunk = NULL;
+    writer->transform = NULL;
+    writer->grid = (SplatGrid){0, 0};
+    writer->staged = 0;
+    writer->written = 0;
+    writer->failed = 0;
+}
+
+static int splat_writer_flush(SplatWriter* writer) {
+    if (writer->staged > 0 && !writer->failed) {
+        if (writer->sink->write(writer->sink->user_data, writer->chunk, writer->staged) != 0) {
+            writer->failed = 1;
+        }
+    }
+    writer->staged = 0;
+    return writer->failed ? -1 : 0;
+}
+
+static void splat_writer_interleave(const SplatWriter* writer, const SplatArrays* arrays, int index, int count,
+                                    Splat* splats) {
+    if (arrays->position[0]) {
+        splat_arrays_interleave(arrays, index, count, splats);
+    } else {
+        splat_grid_interleave(arrays, &writer->grid, index, count, splats);
+    }
+}
+
+// Appends count splats starting at arrays[index], interleaving them into the chunk (or the mapping) and
+// flushing every full chunk
+static int splat_writer_append(SplatWriter* writer, const SplatArrays* arrays, int index, int count) {
+    if (writer->failed) {
+        return -1;
+    }
+    if (writer->mapped) {
+        splat_writer_interleave(writer, arrays, index, count, &writer->mapped[writer->written]);
+        if (writer->transform) {
+            transform_splats(&writer->mapped[writer->written], count, writer->transform);
+        }
+        writer->written += count;
+        return 0;
+    }
+    while (count > 0) {
+        int n = WRITE_CHUNK_SPLATS - writer->staged < count ? WRITE_CHUNK_SPLATS - writer->staged : count;
+        splat_writer_interleave(writer, arrays, index, n, &writer->chunk[writer->staged]);
+        if (writer->transform) {
+            transform_splats(&writer->chunk[writer->staged], n, writer->transform);
+        }
+        writer->staged += n;
+        writer->written += n;
+        index += n;
+        count -= n;
+        if (writer->staged == WRITE_CHUNK_SPLATS && splat_writer_flush(writer) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int splat_writer_append_splat(SplatWriter* writer, const Splat* splat) {
+    if (writer->failed) {
+        return -1;
+    }
+    Splat* destination = writer->mapped ? &writer->mapped[writer->written] : &writer->chunk[writer->staged++];
+    *destination = *splat;
+    if (writer->transform) {
+        transform_splats(destination, 1, writer->transform);
+    }
+    writer->written++;
+    return !writer->mapped && writer->staged == WRITE_CHUNK_SPLATS ? splat_writer_flush(writer) : 0;
+}
+
+// Flushes the staging chunk. Returns the number of splats written or -1 when the sink failed.
+static long long splat_writer_finish(SplatWriter* writer) {
+    if (!writer->mapped) {
+        splat_writer_flush(writer);
+    }
+    return writer->failed ? -1 : writer->written;
+}
+
+// Destination of coalesced splats: appended to a writer when one is set, otherwise stored at
+// splats[count]
+typedef struct {
+    SplatArrays splats;
+    SplatWriter* writer;
+    int count;
+} SplatSink;
+
+// Emits count splats starting at arrays[index]
+static void splat_sink_emit_run(SplatSink* sink, const SplatArrays* arrays, int index, int count) {
+    if (sink->writer) {
+        splat_writer_append(sink->writer, arrays, index, count);
+    } else if (&sink->splats.color[0][sink->count] != &arrays->color[0][index]) {
+        splat_arrays_move(&sink->splats, sink->count, arrays, index, count);
+    }
+    sink->count += count;
+}
+
+static void splat_sink_emit(SplatSink* sink, const Splat* splat) {
+    if (sink->writer) {
+        splat_writer_append_splat(sink->writer, splat);
+    } else {
+        splat_arrays_store(&sink->splats, sink->count, splat);
+    }
+    sink->count++;
+}
+
+// A rectangle of identically colored pixels covering columns [x_begin, x_end) from row y_begin down to
+// the last row pushed, with the range and sum of its depths. splat is a copy of the splat of its top left
+// pixel.
+typedef struct {
+    int x_begin;
+    int x_end;
+    int y_begin;
+    float depth_min;
+    float depth_max;
+    double depth_sum;
+    Splat splat;
+} SplatRect;
+
+// Merges identical pixels into rectangles in a single pass over the rows. Each row is split into maximal
+// runs of one color whose depths stay within the depth tolerance, and a run extends the rectangle above
+// it when it spans exactly the same columns with the same color and the combined depths still fit. A
+// rectangle is emitted as one splat as soon as a row does not continue it, so only the rectangles
+// touching the previous row are kept and the state is O(width).
+typedef struct {
+    int width;
+    float depth_tolerance;
+    int next_row;
+    SplatRect* open;
+    int num_open;
+    SplatRect* continued;
+} RectCoalescer;
+
+static int same_color(const SplatArrays* row, int a, int b) {
+    return row->color[0][a] == row->color[0][b] &&
+           row->color[1][a] == row->color[1][b] &&
+           row->color[2][a] == row->color[2][b];
+}
+
+static int same_color_as_splat(const SplatArrays* row, int index, const Splat* splat) {
+    return row->color[0][index] == splat->packed_color[0] &&
+           row->color[1][index] == splat->packed_color[1] &&
+           row->color[2][index] == splat->packed_color[2];
+}
+
+// Starts a new image, keeping the buffers
+static void rect_coalescer_reset(RectCoalescer* coalescer, float depth_tolerance) {
+    coalescer->depth_tolerance = depth_tolerance;
+    coalescer->next_row = 0;
+    coalescer->num_open = 0;
+}
+
+static int rect_coalescer_init(RectCoalescer* coalescer, int width, float depth_tolerance) {
+    coalescer->width = width;
+    rect_coalescer_reset(coalescer, depth_tolerance);
+    coalescer->open = (SplatRect*)malloc(width * sizeof(SplatRect));
+    coalescer->continued = (SplatRect*)malloc(width * sizeof(SplatRect));
+    return coalescer->open && coalescer->continued ? 0 : -1;
+}
+
+static void rect_coalescer_free(RectCoalescer* coalescer) {
+    free(coalescer->open);
+    free(coalescer->continued);
+}
+
+// Centers the rectangle's splat on the block it covers at its mean depth, and stretches its scale to the
+// block and to the spread of its depths
+static void emit_splat_rect(const SplatRect* rect, int y_end, SplatSink* sink) {
+    Splat merged = rect->splat;
+    int rect_width = rect->x_end - rect->x_begin;
+    int rect_height = y_end - rect->y_begin;
+    merged.packed_position[0] = (float)(rect->x_begin + rect->x_end - 1) / 2.0f;
+    merged.packed_position[1] = (float)(rect->y_begin + y_end - 1) / 2.0f;
+    merged.packed_position[2] = (float)(rect->depth_sum / ((double)rect_width * rect_height));
+    merged.packed_scale[SCALE_X] += logf((float)rect_width);
+    merged.packed_scale[SCALE_Y] += logf((float)rect_height);
+    // Skipped for a single non-finite depth, whose spread is NaN
+    if (rect->depth_max > rect->depth_min) {
+        merged.packed_scale[SCALE_DEPTH] += logf(1.0f + (rect->depth_max - rect->depth_min));
+    }
+    splat_sink_emit(sink, &merged);
+}
+
+// Pushes the next image row. Rectangles the row does not continue are emitted into the sink, which may
+// write into rows that were pushed before this one but never into this row. In a delta conversion the
+// unchanged pixels are skipped and end the runs around them.
+static void rect_coalescer_push_row(RectCoalescer* coalescer, const SplatArrays* row, const unsigned char* changed,
+                                    SplatSink* sink) {
+    int y = coalescer->next_row++;
+    int width = coalescer->width;
+    float depth_tolerance = coalescer->depth_tolerance;
+    int open_index = 0;
+    int num_continued = 0;
+
+    int x = 0;
+    while (x < width) {
+        if (changed && !changed[x]) {
+            x++;
+            continue;
+        }
+        int run_begin = x;
+        float depth_min = row->position[2][x];
+        float depth_max = depth_min;
+        double depth_sum = depth_min;
+        // A non-finite depth matches nothing, so it stays a splat of its own
+        int finite = isfinite(depth_min);
+        x++;
+        while (finite && x < width && (!changed || changed[x]) && same_color(row, run_begin, x)) {
+            float depth = row->position[2][x];
+            float run_min = depth < depth_min ? depth : depth_min;
+            float run_max = depth > depth_max ? depth : depth_max;
+            if (!isfinite(depth) || run_max - run_min > depth_tolerance) {
+                break;
+            }
+            depth_min = run_min;
+            depth_max = run_max;
+            depth_sum += depth;
+            x++;
+        }
+
+        // Rectangles from the row above that start left of this run can no longer be continued
+        while (open_index < coalescer->num_open && coalescer->open[open_index].x_begin < run_begin) {
+            emit_splat_rect(&coalescer->open[open_index++], y, sink);
+        }
+
+        SplatRect* rect = &coalescer->continued[num_continued++];
+        SplatRect* above = open_index < coalescer->num_open ? &coalescer->open[open_index] : NULL;
+        if (finite && above && isfinite(above->depth_sum) && above->x_begin == run_begin && above->x_end == x && same_color_as_splat(row, run_begin, &above->splat) &&
+            (depth_max > above->depth_max ? depth_max : above->depth_max) -
+            (depth_min < above->depth_min ? depth_min : above->depth_min) <= depth_tolerance) {
+            *rect = *above;
+            open_index++;
+            rect->depth_min = depth_min < rect->depth_min ? depth_min : rect->depth_min;
+            rect->depth_max = depth_max > rect->depth_max ? depth_max : rect->depth_max;
+            rect->depth_sum += depth_sum;
+        } else {
+            rect->x_begin = run_begin;
+            rect->x_end = x;
+            rect->y_begin = y;
+            rect->depth_min = depth_min;
+            rect->depth_max = depth_max;
+            rect->depth_sum = depth_sum;
+            splat_arrays_load(row, run_begin, &rect->splat);
+        }
+    }
+    while (open_index < coalescer->num_open) {
+        emit_splat_rect(&coalescer->open[open_index++], y, sink);
+    }
+
+    SplatRect* swap = coalescer->open;
+    coalescer->open = coalescer->continued;
+    coalescer->continued = swap;
+    coalescer->num_open = num_continued;
+}
+
+// Emits the rectangles that are still open after the last row
+static void rect_coalescer_finish(RectCoalescer* coalescer, SplatSink* sink) {
+    for (int i = 0; i < coalescer->num_open; i++) {
+        emit_splat_rect(&coalescer->open[i], coalescer->next_row, sink);
+    }
+    coalescer->num_open = 0;
+}
+
+// Largest block the quadtree coalescer merges into one splat; images are split into tiles of this size
+#define QUADTREE_MAX_BLOCK 64
+
+// Color channels, depth and the changed flag of a delta conversion are tracked by the quadtree coalescer
+#define QUADTREE_CHANNELS 6
+#define QUADTREE_CHANGED 4
+#define QUADTREE_NONFINITE 5
+
+// Merges square blocks whose colors vary by less than a tolerance. Rows are buffered into bands of
+// QUADTREE_MAX_BLOCK rows as integral images of the color and depth and of their squares, so the mean and
+// variance of any block cost O(1). Each tile of a completed band is then subdivided top down until a
+// block's per-channel color variance and depth variance are within tolerance, and that block is emitted
+// as one splat of its mean color at its mean depth. In a delta conversion blocks without changed pixels
+// are dropped and blocks mixing changed and unchanged pixels are split further. Non-finite depths are
+// counted rather than summed, so they never poison the integral images, and are never merged. Depths are
+// summed relative to the first finite depth of their tile in the band, so the sums stay small and the
+// variance of a block at a large depth does not cancel away its precision.
+typedef struct {
+    int width;
+    double max_variance;
+    double max_depth_variance;
+    int next_row;
+    int band_rows;
+    Splat band_splat; // Top left splat of the band, the template for the merged splats
+    double* sums;     // (QUADTREE_MAX_BLOCK + 1) x (width + 1) x QUADTREE_CHANNELS integral image
+    double* squares;  // Same for the squared values
+    float* depth_references; // Per tile of the band, NaN until the tile has a finite depth
+} QuadtreeCoalescer;
+
+// Starts a new image, keeping the integral images. Their first row and column are never written, so they
+// stay zero. tolerance is the largest standard deviation per color channel, in 8-bit levels, and
+// depth_tolerance the largest standard deviation of the depth.
+static void quadtree_coalescer_reset(QuadtreeCoalescer* coalescer, float tolerance, float depth_tolerance) {
+    float tolerance_sh = tolerance / (255.0f * C0);
+    // A little slack so uniform blocks still merge at tolerance 0 despite rounding in the sums
+    coalescer->max_variance = (double)tolerance_sh * tolerance_sh + 1e-9;
+    coalescer->max_depth_variance = (double)depth_tolerance * depth_tolerance + 1e-6;
+    coalescer->next_row = 0;
+    coalescer->band_rows = 0;
+}
+
+static int quadtree_coalescer_init(QuadtreeCoalescer* coalescer, int width, float tolerance, float depth_tolerance) {
+    coalescer->width = width;
+    quadtree_coalescer_reset(coalescer, tolerance, depth_tolerance);
+    size_t integral_size = (size_t)(QUADTREE_MAX_BLOCK + 1) * (width + 1) * QUADTREE_CHANNELS;
+    coalescer->sums = (double*)calloc(integral_size, sizeof(double));
+    coalescer->squares = (double*)calloc(integral_size, sizeof(double));
+    int num_tiles = (width + QUADTREE_MAX_BLOCK - 1) / QUADTREE_MAX_BLOCK;
+    coalescer->depth_references = (float*)malloc(num_tiles * sizeof(float));
+    return coalescer->sums && coalescer->squares && coalescer->depth_references ? 0 : -1;
+}
+
+static void quadtree_coalescer_free(QuadtreeCoalescer* coalescer) {
+    free(coalescer->sums);
+    free(coalescer->squares);
+    free(coalescer->depth_references);
+}
+
+static void emit_quadtree_block(QuadtreeCoalescer* coalescer, int x_begin, int y_begin, int x_end, int y_end,
+                                SplatSink* sink) {
+    const double* sums = coalescer->sums;
+    const double* squares = coalescer->squares;
+    int stride = (coalescer->width + 1) * QUADTREE_CHANNELS;
+    int top_left = y_begin * stride + x_begin * QUADTREE_CHANNELS;
+    int top_right = y_begin * stride + x_end * QUADTREE_CHANNELS;
+    int bottom_left = y_end * stride + x_begin * QUADTREE_CHANNELS;
+    int bottom_right = y_end * stride + x_end * QUADTREE_CHANNELS;
+    int block_width = x_end - x_begin;
+    int block_height = y_end - y_begin;
+    double n = (double)block_width * block_height;
+
+    double mean[QUADTREE_CHANNELS];
+    double variance[QUADTREE_CHANNELS];
+    int uniform = 1;
+    for (int c = 0; c < QUADTREE_CHANGED; c++) {
+        double sum = sums[bottom_right + c] - sums[top_right + c] - sums[bottom_left + c] + sums[top_left + c];
+        double square = squares[bottom_right + c] - squares[top_right + c] - squares[bottom_left + c] + squares[top_left + c];
+        mean[c] = sum / n;
+        variance[c] = square / n - mean[c] * mean[c];
+        if (variance[c] > (c < 3 ? coalescer->max_variance : coalescer->max_depth_variance)) {
+            uniform = 0;
+        }
+    }
+    // The flags are 0 or 1, so their sums are exact
+    double num_changed = sums[bottom_right + QUADTREE_CHANGED] - sums[top_right + QUADTREE_CHANGED] -
+                         sums[bottom_left + QUADTREE_CHANGED] + sums[top_left + QUADTREE_CHANGED];
+    if (num_changed == 0.0) {
+        return;
+    }
+    if (num_changed < n) {
+        uniform = 0;
+    }
+    double num_nonfinite = sums[bottom_right + QUADTREE_NONFINITE] - sums[top_right + QUADTREE_NONFINITE] -
+                           sums[bottom_left + QUADTREE_NONFINITE] + sums[top_left + QUADTREE_NONFINITE];
+    if (num_nonfinite > 0.0) {
+        uniform = 0;
+        if (n == 1.0) {
+            // The depth itself was not summed
+            mean[3] = NAN;
+            variance[3] = 0.0;
+        }
+    }
+
+    if (!uniform && block_width > 1 && block_height > 1) {
+        int x_mid = x_begin + block_width / 2;
+        int y_mid = y_begin + block_height / 2;
+        emit_quadtree_block(coalescer, x_begin, y_begin, x_mid, y_mid, sink);
+        emit_quadtree_block(coalescer, x_mid, y_begin, x_end, y_mid, sink);
+        emit_quadtree_block(coalescer, x_begin, y_mid, x_mid, y_end, sink);
+        emit_quadtree_block(coalescer, x_mid, y_mid, x_end, y_end, sink);
+        return;
+    }
+    if (!uniform) {
+        // A one pixel wide strip, split it along its length
+        int x_mid = x_begin + block_width / 2;
+        int y_mid = y_begin + block_height / 2;
+        if (block_width > 1) {
+            emit_quadtree_block(coalescer, x_begin, y_begin, x_mid, y_end, sink);
+            emit_quadtree_block(coalescer, x_mid, y_begin, x_end, y_end, sink);
+            return;
+        }
+        if (block_height > 1) {
+            emit_quadtree_block(coalescer, x_begin, y_begin, x_end, y_mid, sink);
+            emit_quadtree_block(coalescer, x_begin, y_mid, x_end, y_end, sink);
+            return;
+        }
+    }
+
+    int band_begin = coalescer->next_row - coalescer->band_rows;
+    Splat merged = coalescer->band_splat;
+    merged.packed_position[0] = (float)(x_begin + x_end - 1) / 2.0f;
+    merged.packed_position[1] = (float)(2 * band_begin + y_begin + y_end - 1) / 2.0f;
+    merged.packed_position[2] = (float)(mean[3] + coalescer->depth_references[x_begin / QUADTREE_MAX_BLOCK]);
+    for (int c = 0; c < 3; c++) {
+        merged.packed_color[c] = (float)mean[c];
+    }
+    // Two standard deviations stand in for the spread of the depths
+    double depth_spread = variance[3] > 0.0 ? 2.0 * sqrt(variance[3]) : 0.0;
+    merged.packed_scale[SCALE_X] += logf((float)block_width);
+    merged.packed_scale[SCALE_Y] += logf((float)block_height);
+    merged.packed_scale[SCALE_DEPTH] += logf((float)(1.0 + depth_spread));
+    splat_sink_emit(sink, &merged);
+}
+
+static void quadtree_coalescer_flush(QuadtreeCoalescer* coalescer, SplatSink* sink) {
+    for (int x = 0; x < coalescer->width; x += QUADTREE_MAX_BLOCK) {
+        int x_end = x + QUADTREE_MAX_BLOCK < coalescer->width ? x + QUADTREE_MAX_BLOCK : coalescer->width;
+        emit_quadtree_block(coalescer, x, 0, x_end, coalescer->band_rows, sink);
+    }
+    coalescer->band_rows = 0;
+}
+
+// Pushes the next image row into the current band. The band is coalesced once it is full; the row has
+// been copied into the integral images by then, so the sink may overwrite it.
+static void quadtree_coalescer_push_row(QuadtreeCoalescer* coalescer, const SplatArrays* row,
+                                        const unsigned char* changed, SplatSink* sink) {
+    int stride = (coalescer->width + 1) * QUADTREE_CHANNELS;
+    double* sums = &coalescer->sums[(coalescer->band_rows + 1) * stride];
+    double* squares = &coalescer->squares[(coalescer->band_rows + 1) * stride];
+    if (coalescer->band_rows == 0) {
+        splat_arrays_load(row, 0, &coalescer->band_splat);
+        for (int tile = 0; tile * QUADTREE_MAX_BLOCK < coalescer->width; tile++) {
+            coalescer->depth_references[tile] = NAN;
+        }
+    }
+
+    double row_sum[QUADTREE_CHANNELS] = {0.0, 0.0, 0.0, 0.0, 0.0, 0.0};
+    double row_square[QUADTREE_CHANNELS] = {0.0, 0.0, 0.0, 0.0, 0.0, 0.0};
+    for (int x = 0; x < coalescer->width; x++) {
+        float depth = row->position[2][x];
+        int finite = isfinite(depth);
+        float* reference = &coalescer->depth_references[x / QUADTREE_MAX_BLOCK];
+        if (finite && isnan(*reference)) {
+            *reference = depth;
+        }
+        for (int c = 0; c < QUADTREE_CHANNELS; c++) {
+            double value = c < 3 ? row->color[c][x] : c == 3 ? (finite ? (double)depth - *reference : 0.0)
+                         : c == QUADTREE_CHANGED ? !changed || changed[x] : !finite;
+            row_sum[c] += value;
+            row_square[c] += value * value;
+            sums[(x + 1) * QUADTREE_CHANNELS + c] = sums[(x + 1) * QUADTREE_CHANNELS + c - stride] + row_sum[c];
+            squares[(x + 1) * QUADTREE_CHANNELS + c] = squares[(x + 1) * QUADTREE_CHANNELS + c - stride] + row_square[c];
+        }
+    }
+
+    coalescer->next_row++;
+    if (++coalescer->band_rows == QUADTREE_MAX_BLOCK) {
+        quadtree_coalescer_flush(coalescer, sink);
+    }
+}
+
+static void quadtree_coalescer_finish(QuadtreeCoalescer* coalescer, SplatSink* sink) {
+    if (coalescer->band_rows > 0) {
+        quadtree_coalescer_flush(coalescer, sink);
+    }
+}
+
+// Row by row front end over the coalescing strategies. Without coalescing the rows are passed to the sink
+// unchanged.
+typedef struct {
+    CoalesceMode mode;
+    int width;
+    RectCoalescer rect;
+    QuadtreeCoalescer quadtree;
+} SplatCoalescer;
+
+static int splat_coalescer_init(SplatCoalescer* coalescer, const CoalesceOptions* options, int width) {
+    memset(coalescer, 0, sizeof(SplatCoalescer));
+    coalescer->mode = options->mode;
+    coalescer->width = width;
+    switch (options->mode) {
+        case COALESCE_RECT:
+            return rect_coalescer_init(&coalescer->rect, width, options->depth_tolerance);
+        case COALESCE_QUADTREE:
+            return quadtree_coalescer_init(&coalescer->quadtree, width, options->tolerance, options->depth_tolerance);
+        default:
+            return 0;
+    }
+}
+
+static void splat_coalescer_free(SplatCoalescer* coalescer) {
+    rect_coalescer_free(&coalescer->rect);
+    quadtree_coalescer_free(&coalescer->quadtree);
+    memset(coalescer, 0, sizeof(SplatCoalescer));
+}
+
+// Readies the coalescer for a new image, reusing its buffers when the mode and width are unchanged
+static int splat_coalescer_prepare(SplatCoalescer* coalescer, const CoalesceOptions* options, int width) {
+    if (coalescer->mode != options->mode || coalescer->width != width) {
+        splat_coalescer_free(coalescer);
+        return splat_coalescer_init(coalescer, options, width);
+    }
+    rect_coalescer_reset(&coalescer->rect, options->depth_tolerance);
+    quadtree_coalescer_reset(&coalescer->quadtree, options->tolerance, options->depth_tolerance);
+    return 0;
+}
+
+// Passes the runs of changed pixels of a row to the sink unchanged
+static void emit_changed_runs(const SplatArrays* rows, int row_index, const unsigned char* changed, int width,
+                              SplatSink* sink) {
+    int x = 0;
+    while (x < width) {
+        while (x < width && !changed[x]) {
+            x++;
+        }
+        int run_begin = x;
+        while (x < width && changed[x]) {
+            x++;
+        }
+        if (x > run_begin) {
+            splat_sink_emit_run(sink, rows, row_index + run_begin, x - run_begin);
+        }
+    }
+}
+
+// Pushes num_rows consecutive rows of width splats. changed holds the changed flags of the rows in a
+// delta conversion and is NULL otherwise.
+static void splat_coalescer_push_rows(SplatCoalescer* coalescer, const SplatArrays* rows,
+                                      const unsigned char* changed, int width, int num_rows, SplatSink* sink) {
+    for (int y = 0; y < num_rows; y++) {
+        SplatArrays row = splat_arrays_at(rows, y * width);
+        const unsigned char* row_changed = changed ? &changed[y * width] : NULL;
+        switch (coalescer->mode) {
+            case COALESCE_RECT:
+                rect_coalescer_push_row(&coalescer->rect, &row, row_changed, sink);
+                break;
+            case COALESCE_QUADTREE:
+                quadtree_coalescer_push_row(&coalescer->quadtree, &row, row_changed, sink);
+                break;
+            default:
+                if (row_changed) {
+                    emit_changed_runs(rows, y * width, row_changed, width, sink);
+                } else {
+                    splat_sink_emit_run(sink, rows, y * width, width);
+                }
+                break;
+        }
+    }
+}
+
+static void splat_coalescer_finish(SplatCoalescer* coalescer, SplatSink* sink) {
+    switch (coalescer->mode) {
+        case COALESCE_RECT:
+            rect_coalescer_finish(&coalescer->rect, sink);
+            break;
+        case COALESCE_QUADTREE:
+            quadtree_coalescer_finish(&coalescer->quadtree, sink);
+            break;
+        default:
+            break;
+    }
+}
+
+
+// Coalesces rows [0, height) of splats in place. Merged splats are only emitted for rows that have already
+// been pushed, and no more of them than pixels pushed, so they always land on slots that have already been
+// consumed. Returns the number of merged splats now at the front of the arrays.
+static int coalesce_splats(SplatCoalescer* coalescer, SplatArrays* splats, const unsigned char* changed, int width,
+                           int height) {
+    SplatSink sink = {*splats, NULL, 0};
+    splat_coalescer_push_rows(coalescer, splats, changed, width, height, &sink);
+    splat_coalescer_finish(coalescer, &sink);
+    return sink.count;
+}
+
+struct SplatinitContext {
+    SplatArrays splats;     // The whole image or one band of it
+    unsigned char* changed; // Changed flags of the same pixels in a delta conversion
+    int capacity;
+    SplatLayout layout; // Of the splat arrays
+    Splat* chunk;       // Staging chunk of the writer
+    SplatCoalescer coalescer;
+};
+
+SplatinitContext* splatinit_create(void) {
+    SplatinitContext* context = (SplatinitContext*)calloc(1, sizeof(SplatinitContext));
+    if (!context) {
+        return NULL;
+    }
+    context->chunk = (Splat*)malloc(WRITE_CHUNK_SPLATS * sizeof(Splat));
+    if (!context->chunk) {
+        free(context);
+        return NULL;
+    }
+    return context;
+}
+
+void splatinit_destroy(SplatinitContext* context) {
+    if (!context) {
+        return;
+    }
+    splat_arrays_free(&context->splats);
+    free(context->changed);
+    splat_coalescer_free(&context->coalescer);
+    free(context->chunk);
+    free(context);
+}
+
+void splatinit_default_options(SplatinitOptions* options) {
+    options->coalesce.mode = COALESCE_RECT;
+    options->coalesce.tolerance = 0.0f;
+    options->coalesce.depth_tolerance = 0.0f;
+    options->num_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    options->band_rows = 0;
+    options->color_kernel = "auto";
+    options->comments = NULL;
+    options->depth_format = DEPTH_U8;
+    options->camera.fx = 0.0f;
+    options->camera.fy = 0.0f;
+    options->camera.cx = NAN;
+    options->camera.cy = NAN;
+    options->pose = NULL;
+    options->format = FORMAT_PLY;
+    options->precision = PRECISION_FLOAT;
+}
+
+// Grows the splat arrays and changed flags to hold at least capacity splats, reallocating the arrays when
+// the layout changes. Their contents are not kept.
+static int reserve_splats(SplatinitContext* context, int capacity, SplatLayout layout) {
+    if (capacity <= context->capacity && layout == context->layout) {
+        return 0;
+    }
+    splat_arrays_free(&context->splats);
+    free(context->changed);
+    context->changed = NULL;
+    context->capacity = 0;
+    context->layout = layout;
+    if (splat_arrays_alloc(&context->splats, capacity, layout) != 0) {
+        return -1;
+    }
+    context->changed = (unsigned char*)malloc(capacity);
+    if (!context->changed) {
+        splat_arrays_free(&context->splats);
+        return -1;
+    }
+    context->capacity = capacity;
+    return 0;
+}
+
+// Resolves the color kernel, readies the coalescer and reserves the splats of band_rows rows of the source,
+// on the pixel grid when no pixel is merged or dropped
+static const RgbToShKernelInfo* prepare_conversion(SplatinitContext* context, const SplatinitOptions* options,
+                                                   const SplatSource* source, int band_rows) {
+    int width = source->width;
+    SplatLayout layout = SPLAT_LAYOUT_FULL;
+    if (options->coalesce.mode == COALESCE_NONE && !source->previous_image_data) {
+        layout = source->depth_data ? SPLAT_LAYOUT_GRID_DEPTH : SPLAT_LAYOUT_GRID;
+    }
+    const RgbToShKernelInfo* kernel = select_rgb_to_sh_kernel(options->color_kernel ? options->color_kernel : "auto");
+    if (!kernel) {
+        return NULL;
+    }
+    if (splat_coalescer_prepare(&context->coalescer, &options->coalesce, width) != 0) {
+        splat_coalescer_free(&context->coalescer);
+        return NULL;
+    }
+    if (reserve_splats(context, band_rows * width, layout) != 0) {
+        return NULL;
+    }
+    return kernel;
+}
+
+// Generates the splats band_rows image rows at a time and passes them through the coalescer into the
+// writer, so only a band of splat arrays is ever needed. The coalescer carries its state from one band
+// into the next.
+static void write_splat_bands(SplatinitContext* context, const SplatSource* source, int band_rows,
+                              RgbToShKernel kernel, int num_threads, SplatWriter* writer) {
+    SplatSink sink = {context->splats, writer, 0};
+    unsigned char* changed = source->previous_image_data ? context->changed : NULL;
+    for (int band_begin = 0; band_begin < source->height && !writer->failed; band_begin += band_rows) {
+        int band_end = band_begin + band_rows < source->height ? band_begin + band_rows : source->height;
+        writer->grid = (SplatGrid){source->width, band_begin};
+        generate_splats(&context->splats, changed, source, band_begin, band_end, kernel, num_threads);
+        splat_coalescer_push_rows(&context->coalescer, &context->splats, changed, source->width,
+                                  band_end - band_begin, &sink);
+    }
+    splat_coalescer_finish(&context->coalescer, &sink);
+}
+
+static int convert_source(SplatinitContext* context, const SplatSource* source, const SplatinitOptions* options,
+                          const SplatinitSink* sink) {
+    int width = source->width;
+    int height = source->height;
+    int band_rows = options->band_rows > 0 && options->band_rows < height ? options->band_rows : height;
+    const RgbToShKernelInfo* kernel = prepare_conversion(context, options, source, band_rows);
+    if (!kernel) {
+        return -1;
+    }
+
+    SplatWriter writer;
+    SplatTransform transform;
+    splat_writer_init(&writer, sink, context->chunk);
+    writer.grid = (SplatGrid){width, 0};
+    if (resolve_transform(options, width, height, &transform)) {
+        writer.transform = &transform;
+    }
+    if (band_rows == height) {
+        // The whole image fits, so it is coalesced in place first and the sink learns the count up front
+        unsigned char* changed = source->previous_image_data ? context->changed : NULL;
+        generate_splats(&context->splats, changed, source, 0, height, kernel->kernel, options->num_threads);
+        int num_splats = coalesce_splats(&context->coalescer, &context->splats, changed, width, height);
+        if (sink->begin && sink->begin(sink->user_data, num_splats) != 0) {
+            return -1;
+        }
+        splat_writer_append(&writer, &context->splats, 0, num_splats);
+    } else {
+        if (sink->begin && sink->begin(sink->user_data, -1) != 0) {
+            return -1;
+        }
+        write_splat_bands(context, source, band_rows, kernel->kernel, options->num_threads, &writer);
+    }
+    return (int)splat_writer_finish(&writer);
+}
+
+int splatinit_convert(SplatinitContext* context, const uint8_t* rgb, const void* depth, int width, int height,
+                      const SplatinitOptions* options, const SplatinitSink* sink) {
+    SplatSource source = {rgb, depth, NULL, NULL, options->depth_format, width, height};
+    return convert_source(context, &source, options, sink);
+}
+
+int splatinit_convert_delta(SplatinitContext* context, const uint8_t* rgb, const void* depth,
+                            const uint8_t* previous_rgb, const void* previous_depth, int width, int height,
+                            const SplatinitOptions* options, const SplatinitSink* sink) {
+    SplatSource source = {rgb, depth, previous_rgb, previous_depth, options->depth_format, width, height};
+    return convert_source(context, &source, options, sink);
+}
+
+// Width of the zero padded vertex count in a header written before the count is known, enough for any int
+#define STREAM_COUNT_DIGITS 10
+// Rows per band when mapping the output file and no band size is given
+#define DEFAULT_MAPPED_BAND_ROWS 64
+
+// Converts count floats to half precision, rounding to nearest even
+typedef void (*FloatToHalfKernel)(const float* values, uint16_t* halves, int count);
+
+static uint16_t float_to_half(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    uint32_t sign = (bits >> 16) & 0x8000;
+    uint32_t magnitude = bits & 0x7fffffff;
+    if (magnitude > 0x7f800000) {
+        // Quiet NaN keeping the top of the payload, as F16C does
+        return (uint16_t)(sign | 0x7e00 | (magnitude >> 13 & 0x3ff));
+    }
+    if (magnitude >= 0x47800000) {
+        return (uint16_t)(sign | 0x7c00);
+    }
+    if (magnitude < 0x38800000) {
+        // Subnormal: adding 0.5 aligns the half mantissa with the bottom of the float's, and the float
+        // addition rounds to nearest even
+        float aligned;
+        memcpy(&aligned, &magnitude, sizeof(aligned));
+        aligned += 0.5f;
+        memcpy(&magnitude, &aligned, sizeof(magnitude));
+        return (uint16_t)(sign | (magnitude - 0x3f000000));
+    }
+    // Rebias the exponent and round to nearest even; a mantissa carry rounds up into the exponent, and
+    // past the largest half into infinity
+    magnitude += 0xc8000fff + (magnitude >> 13 & 1);
+    return (uint16_t)(sign | magnitude >> 13);
+}
+
+static void float_to_half_scalar(const float* values, uint16_t* halves, int count) {
+    for (int i = 0; i < count; i++) {
+        halves[i] = float_to_half(values[i]);
+    }
+}
+
+#ifdef SPLATINIT_X86
+__attribute__((target("avx,f16c")))
+static void float_to_half_f16c(const float* values, uint16_t* halves, int count) {
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i packed = _mm256_cvtps_ph(_mm256_loadu_ps(&values[i]), _MM_FROUND_TO_NEAREST_INT);
+        _mm_storeu_si128((__m128i*)&halves[i], packed);
+    }
+    float_to_half_scalar(&values[i], &halves[i], count - i);
+}
+#endif
+
+// Both kernels give the same bits, so the CPU never changes the output
+static FloatToHalfKernel select_float_to_half_kernel() {
+#ifdef SPLATINIT_X86
+    if (__builtin_cpu_supports("avx") && __builtin_cpu_supports("f16c")) {
+        return float_to_half_f16c;
+    }
+#endif
+    return float_to_half_scalar;
+}
+
+// Splats packed into vertices at a time by the formats that rewrite every field
+#define ENCODE_BLOCK_SPLATS 1024
+#define HALF_SPLAT_SIZE (3 * sizeof(float) + (SPLAT_FLOATS - 3) * sizeof(uint16_t))
+// A .splat record: position and scale as floats, then RGBA8 color and the rotation in 8 bits per component
+#define SPLAT_RECORD_SIZE 32
+
+// Rotation components are scaled to +-128 around 128, as in the .splat format
+static float splat_rotation_scale(const float rotation[4]) {
+    float length = sqrtf(rotation[0] * rotation[0] + rotation[1] * rotation[1] + rotation[2] * rotation[2] +
+                         rotation[3] * rotation[3]);
+    return length > 0.0f ? 128.0f / length : 0.0f;
+}
+
+#ifndef SPLATINIT_X86
+static uint8_t clamp_byte(float value) {
+    long rounded = lrintf(value);
+    return (uint8_t)(rounded < 0 ? 0 : rounded > 255 ? 255 : rounded);
+}
+
+// Colors go back from SH DC to 8-bit RGB, the opacity through the sigmoid viewers apply to it becomes the
+// alpha, and the log scales the splats are written with become linear
+static void pack_splat_records(const Splat* splats, unsigned char* records, int count) {
+    for (int i = 0; i < count; i++) {
+        const Splat* splat = &splats[i];
+        unsigned char* record = &records[i * SPLAT_RECORD_SIZE];
+        float scale[3] = {expf(splat->packed_scale[0]), expf(splat->packed_scale[1]), expf(splat->packed_scale[2])};
+        memcpy(record, splat->packed_position, 3 * sizeof(float));
+        memcpy(record + 12, scale, 3 * sizeof(float));
+        for (int c = 0; c < 3; c++) {
+            record[24 + c] = clamp_byte(splat->packed_color[c] * (255.0f * C0) + 127.5f);
+        }
+        record[27] = clamp_byte(255.0f / (1.0f + expf(-splat->opacity)));
+        float rotation_scale = splat_rotation_scale(splat->packed_rotation);
+        for (int c = 0; c < 4; c++) {
+            record[28 + c] = clamp_byte(splat->packed_rotation[c] * rotation_scale + 128.0f);
+        }
+    }
+}
+#else
+// The same arithmetic, with the color and opacity, and the rotation, each packed as a vector of four
+// floats rounded and saturated down to four bytes
+static void pack_splat_records(const Splat* splats, unsigned char* records, int count) {
+    const __m128 color_scale = _mm_setr_ps(255.0f * C0, 255.0f * C0, 255.0f * C0, 0.0f);
+    const __m128 rotation_bias = _mm_set1_ps(128.0f);
+    for (int i = 0; i < count; i++) {
+        const Splat* splat = &splats[i];
+        unsigned char* record = &records[i * SPLAT_RECORD_SIZE];
+        float scale[3] = {expf(splat->packed_scale[0]), expf(splat->packed_scale[1]), expf(splat->packed_scale[2])};
+        memcpy(record, splat->packed_position, 3 * sizeof(float));
+        memcpy(record + 12, scale, 3 * sizeof(float));
+
+        // The color is followed by the opacity, which the zero scale drops for the alpha in the bias
+        float alpha = 255.0f / (1.0f + expf(-splat->opacity));
+        __m128 color = _mm_loadu_ps((const float*)splat + 3);
+        color = _mm_add_ps(_mm_mul_ps(color, color_scale), _mm_setr_ps(127.5f, 127.5f, 127.5f, alpha));
+        __m128 rotation = _mm_loadu_ps(splat->packed_rotation);
+        rotation = _mm_add_ps(_mm_mul_ps(rotation, _mm_set1_ps(splat_rotation_scale(splat->packed_rotation))),
+                              rotation_bias);
+
+        __m128i words = _mm_packs_epi32(_mm_cvtps_epi32(color), _mm_cvtps_epi32(rotation));
+        _mm_storel_epi64((__m128i*)(record + 24), _mm_packus_epi16(words, words));
+    }
+}
+#endif
+
+struct SplatinitEncoder {
+    SplatinitSink sink;
+    FILE* file;
+    OutputFormat format;
+    SplatPrecision precision;
+    const char* comments;
+    int begun;
+    int failed;
+    long long num_splats;
+    // PLY: where the header starts, and the width of the vertex count when it is a placeholder to patch
+    off_t header_offset;
+    int count_digits;
+    // Half precision PLY: a block of splats converted whole, then packed into vertices behind the
+    // full precision positions. The .splat format packs a block into its records.
+    FloatToHalfKernel float_to_half;
+    uint16_t* halves;
+    unsigned char* vertices;
+    // Compressed PLY: the splats of the chunk being filled, then the bounds of every chunk and the packed
+    // splats, which can only be written once the number of chunks is known
+    Splat chunk[COMPRESSED_CHUNK_SPLATS];
+    int staged;
+    float* chunk_bounds;
+    uint32_t* packed;
+    int num_chunks;
+    int chunk_capacity;
+};
+
+// Quantizes a value in [0, 1] to bits bits, rounding to nearest
+static uint32_t pack_unorm(float value, int bits) {
+    float max = (float)((1u << bits) - 1);
+    float scaled = floorf(value * max + 0.5f);
+    return (uint32_t)(scaled < 0.0f ? 0.0f : scaled > max ? max : scaled);
+}
+
+// Packs a vector normalized against the bounds into 11, 10 and 11 bits; flat bounds pack to 0
+static uint32_t pack_11_10_11(const float v[3], const float min[3], const float max[3]) {
+    float n[3];
+    for (int a = 0; a < 3; a++) {
+        n[a] = max[a] - min[a] > 0.0f ? (v[a] - min[a]) / (max[a] - min[a]) : 0.0f;
+    }
+    return pack_unorm(n[0], 11) << 21 | pack_unorm(n[1], 10) << 11 | pack_unorm(n[2], 11);
+}
+
+// Packs the index of the largest component in the top 2 bits and the other three, which lie within
+// +-1/sqrt(2) once the largest is made positive, in 10 bits each. The chunked format orders the components
+// x, y, z, w, while a PLY rotation starts with w.
+static uint32_t pack_rotation(const float rotation[4]) {
+    const float q[4] = {rotation[1], rotation[2], rotation[3], rotation[0]};
+    float length = sqrtf(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+    int largest = 0;
+    for (int i = 1; i < 4; i++) {
+        largest = fabsf(q[i]) > fabsf(q[largest]) ? i : largest;
+    }
+    float sign = q[largest] < 0.0f ? -1.0f : 1.0f;
+    float norm = sign * 0.70710678f / (length > 0.0f ? length : 1.0f);
+    uint32_t packed = (uint32_t)largest;
+    for (int i = 0; i < 4; i++) {
+        if (i != largest) {
+            packed = packed << 10 | pack_unorm(q[i] * norm + 0.5f, 10);
+        }
+    }
+    return packed;
+}
+
+// The SH DC color back to RGB, and the opacity through the sigmoid viewers apply to it, as RGBA8
+static uint32_t pack_color(const float color[3], float opacity) {
+    float alpha = 1.0f / (1.0f + expf(-opacity));
+    return pack_unorm(color[0] * C0 + 0.5f, 8) << 24 | pack_unorm(color[1] * C0 + 0.5f, 8) << 16 |
+           pack_unorm(color[2] * C0 + 0.5f, 8) << 8 | pack_unorm(alpha, 8);
+}
+
+// Packs the staged splats as the next chunk
+static int flush_compressed_chunk(SplatinitEncoder* encoder) {
+    if (encoder->num_chunks == encoder->chunk_capacity) {
+        int capacity = encoder->chunk_capacity ? encoder->chunk_capacity * 2 : 64;
+        float* bounds = (float*)realloc(encoder->chunk_bounds,
+                                        (size_t)capacity * COMPRESSED_CHUNK_FLOATS * sizeof(float));
+        encoder->chunk_bounds = bounds ? bounds : encoder->chunk_bounds;
+        uint32_t* packed = (uint32_t*)realloc(encoder->packed,
+                                              (size_t)capacity * COMPRESSED_CHUNK_SPLATS * 4 * sizeof(uint32_t));
+        encoder->packed = packed ? packed : encoder->packed;
+        if (!bounds || !packed) {
+            return -1;
+        }
+        encoder->chunk_capacity = capacity;
+    }
+
+    float* bounds = &encoder->chunk_bounds[(size_t)encoder->num_chunks * COMPRESSED_CHUNK_FLOATS];
+    float* min_position = &bounds[0];
+    float* max_position = &bounds[3];
+    float* min_scale = &bounds[6];
+    float* max_scale = &bounds[9];
+    for (int a = 0; a < 3; a++) {
+        min_position[a] = max_position[a] = encoder->chunk[0].packed_position[a];
+        min_scale[a] = max_scale[a] = encoder->chunk[0].packed_scale[a];
+    }
+    for (int i = 1; i < encoder->staged; i++) {
+        const Splat* splat = &encoder->chunk[i];
+        for (int a = 0; a < 3; a++) {
+            min_position[a] = fminf(min_position[a], splat->packed_position[a]);
+            max_position[a] = fmaxf(max_position[a], splat->packed_position[a]);
+            min_scale[a] = fminf(min_scale[a], splat->packed_scale[a]);
+            max_scale[a] = fmaxf(max_scale[a], splat->packed_scale[a]);
+        }
+    }
+
+    uint32_t* packed = &encoder->packed[(size_t)encoder->num_chunks * COMPRESSED_CHUNK_SPLATS * 4];
+    for (int i = 0; i < encoder->staged; i++) {
+        const Splat* splat = &encoder->chunk[i];
+        packed[i * 4 + 0] = pack_11_10_11(splat->packed_position, min_position, max_position);
+        packed[i * 4 + 1] = pack_rotation(splat->packed_rotation);
+        packed[i * 4 + 2] = pack_11_10_11(splat->packed_scale, min_scale, max_scale);
+        packed[i * 4 + 3] = pack_color(splat->packed_color, splat->opacity);
+    }
+    encoder->num_chunks++;
+    encoder->staged = 0;
+    return 0;
+}
+
+static int write_half_splats(SplatinitEncoder* encoder, const Splat* splats, int count) {
+    while (count > 0) {
+        int block = count < ENCODE_BLOCK_SPLATS ? count : ENCODE_BLOCK_SPLATS;
+        encoder->float_to_half((const float*)splats, encoder->halves, block * SPLAT_FLOATS);
+        for (int i = 0; i < block; i++) {
+            unsigned char* vertex = &encoder->vertices[i * HALF_SPLAT_SIZE];
+            memcpy(vertex, splats[i].packed_position, 3 * sizeof(float));
+            memcpy(vertex + 3 * sizeof(float), &encoder->halves[i * SPLAT_FLOATS + 3],
+                   (SPLAT_FLOATS - 3) * sizeof(uint16_t));
+        }
+        if (fwrite(encoder->vertices, HALF_SPLAT_SIZE, block, encoder->file) != (size_t)block) {
+            return -1;
+        }
+        splats += block;
+        count -= block;
+    }
+    return 0;
+}
+
+static int write_splat_records(SplatinitEncoder* encoder, const Splat* splats, int count) {
+    while (count > 0) {
+        int block = count < ENCODE_BLOCK_SPLATS ? count : ENCODE_BLOCK_SPLATS;
+        pack_splat_records(splats, encoder->vertices, block);
+        if (fwrite(encoder->vertices, SPLAT_RECORD_SIZE, block, encoder->file) != (size_t)block) {
+            return -1;
+        }
+        splats += block;
+        count -= block;
+    }
+    return 0;
+}
+
+static int begin_encoder(void* user_data, int num_splats) {
+    SplatinitEncoder* encoder = (SplatinitEncoder*)user_data;
+    encoder->begun = 1;
+    if (encoder->format != FORMAT_PLY) {
+        return 0;
+    }
+    char header[PLY_HEADER_CAPACITY];
+    encoder->header_offset = ftello(encoder->file);
+    encoder->count_digits = num_splats < 0 ? STREAM_COUNT_DIGITS : 0;
+    int header_length = format_play_canvas_header(header, num_splats < 0 ? 0 : num_splats, encoder->precision,
+                                                  encoder->count_digits, encoder->comments);
+    return fwrite(header, 1, header_length, encoder->file) == (size_t)header_length ? 0 : -1;
+}
+
+static int write_encoder(void* user_data, const Splat* splats, int count) {
+    SplatinitEncoder* encoder = (SplatinitEncoder*)user_data;
+    if (!encoder->begun && begin_encoder(encoder, -1) != 0) {
+        return -1;
+    }
+    encoder->num_splats += count;
+    if (encoder->format == FORMAT_PLY && encoder->precision == PRECISION_HALF) {
+        return write_half_splats(encoder, splats, count);
+    }
+    if (encoder->format == FORMAT_PLY) {
+        return fwrite(splats, sizeof(Splat), count, encoder->file) == (size_t)count ? 0 : -1;
+    }
+    if (encoder->format == FORMAT_SPLAT) {
+        return write_splat_records(encoder, splats, count);
+    }
+
+    while (count > 0) {
+        int staged = COMPRESSED_CHUNK_SPLATS - encoder->staged;
+        staged = staged < count ? staged : count;
+        memcpy(&encoder->chunk[encoder->staged], splats, staged * sizeof(Splat));
+        encoder->staged += staged;
+        splats += staged;
+        count -= staged;
+        if (encoder->staged == COMPRESSED_CHUNK_SPLATS && flush_compressed_chunk(encoder) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void free_encoder(SplatinitEncoder* encoder) {
+    free(encoder->halves);
+    free(encoder->vertices);
+    free(encoder->chunk_bounds);
+    free(encoder->packed);
+    free(encoder);
+}
+
+SplatinitEncoder* splatinit_encoder_create(const SplatinitOptions* options, FILE* file) {
+    SplatinitEncoder* encoder = (SplatinitEncoder*)calloc(1, sizeof(SplatinitEncoder));
+    if (encoder) {
+        encoder->sink = (SplatinitSink){begin_encoder, write_encoder, encoder};
+        encoder->file = file;
+        encoder->format = options->format;
+        encoder->precision = options->format == FORMAT_PLY ? options->precision : PRECISION_FLOAT;
+        encoder->comments = options->comments;
+    }
+    if (encoder && encoder->precision == PRECISION_HALF) {
+        encoder->float_to_half = select_float_to_half_kernel();
+        encoder->halves = (uint16_t*)malloc(ENCODE_BLOCK_SPLATS * SPLAT_FLOATS * sizeof(uint16_t));
+        encoder->vertices = (unsigned char*)malloc(ENCODE_BLOCK_SPLATS * HALF_SPLAT_SIZE);
+        if (!encoder->halves || !encoder->vertices) {
+            free_encoder(encoder);
+            return NULL;
+        }
+    }
+    if (encoder && encoder->format == FORMAT_SPLAT) {
+        encoder->vertices = (unsigned char*)malloc(ENCODE_BLOCK_SPLATS * SPLAT_RECORD_SIZE);
+        if (!encoder->vertices) {
+            free_encoder(encoder);
+            return NULL;
+        }
+    }
+    return encoder;
+}
+
+const SplatinitSink* splatinit_encoder_sink(SplatinitEncoder* encoder) {
+    return &encoder->sink;
+}
+
+int splatinit_encoder_write(SplatinitEncoder* encoder, const Splat* splats, int count) {
+    if (!encoder->failed && write_encoder(encoder, splats, count) != 0) {
+        encoder->failed = 1;
+    }
+    return encoder->failed ? -1 : 0;
+}
+
+// Writes the compressed file, header, chunks and packed splats, at the current position
+static long long write_compressed_file(SplatinitEncoder* encoder) {
+    if (encoder->staged > 0 && flush_compressed_chunk(encoder) != 0) {
+        return -1;
+    }
+    char header[PLY_HEADER_CAPACITY];
+    int header_length = format_compressed_header(header, encoder->num_chunks, (int)encoder->num_splats,
+                                                 encoder->comments);
+    size_t num_bounds = (size_t)encoder->num_chunks * COMPRESSED_CHUNK_FLOATS;
+    size_t num_packed = (size_t)encoder->num_splats * 4;
+    if (fwrite(header, 1, header_length, encoder->file) != (size_t)header_length ||
+        fwrite(encoder->chunk_bounds, sizeof(float), num_bounds, encoder->file) != num_bounds ||
+        fwrite(encoder->packed, sizeof(uint32_t), num_packed, encoder->file) != num_packed) {
+        return -1;
+    }
+    return header_length + (long long)(num_bounds * sizeof(float) + num_packed * sizeof(uint32_t));
+}
+
+long long splatinit_encoder_finish(SplatinitEncoder* encoder, int* num_splats) {
+    long long bytes_written = -1;
+    if (!encoder->failed && encoder->num_splats <= INT32_MAX) {
+        if (encoder->format == FORMAT_COMPRESSED_PLY) {
+            bytes_written = write_compressed_file(encoder);
+        } else if (encoder->format == FORMAT_SPLAT) {
+            bytes_written = encoder->num_splats * SPLAT_RECORD_SIZE;
+        } else if (encoder->begun || begin_encoder(encoder, 0) == 0) {
+            off_t end = ftello(encoder->file);
+            bytes_written = end - encoder->header_offset;
+            if (encoder->count_digits) {
+                char header[PLY_HEADER_CAPACITY];
+                int header_length = format_play_canvas_header(header, (int)encoder->num_splats, encoder->precision,
+                                                              encoder->count_digits, encoder->comments);
+                if (fseeko(encoder->file, encoder->header_offset, SEEK_SET) != 0 ||
+                    fwrite(header, 1, header_length, encoder->file) != (size_t)header_length ||
+                    fseeko(encoder->file, end, SEEK_SET) != 0) {
+                    bytes_written = -1;
+                }
+            }
+        }
+    }
+    if (num_splats) {
+        *num_splats = (int)encoder->num_splats;
+    }
+    free_encoder(encoder);
+    return bytes_written;
+}
+
+long long splatinit_write_ply(SplatinitContext* context, const uint8_t* rgb, const void* depth, int width,
+                              int height, const SplatinitOptions* options, FILE* file, int* num_splats) {
+    SplatinitEncoder* encoder = splatinit_encoder_create(options, file);
+    if (!encoder) {
+        return -1;
+    }
+    int converted = splatinit_convert(context, rgb, depth, width, height, options, splatinit_encoder_sink(encoder));
+    long long bytes_written = splatinit_encoder_finish(encoder, num_splats);
+    return converted < 0 ? -1 : bytes_written;
+}
+
+// Only writes full precision FORMAT_PLY. The vertex count is zero padded until the header length is a
+// multiple of the splat alignment, so the mapped splats are properly aligned
+long long splatinit_write_ply_mapped(SplatinitContext* context, const uint8_t* rgb, const void* depth,
+                                     int width, int height, const SplatinitOptions* options, FILE* file,
+                                     int* num_splats) {
+    if (options->format != FORMAT_PLY || options->precision != PRECISION_FLOAT) {
+        return -1;
+    }
+    int band_rows = options->band_rows > 0 ? options->band_rows : DEFAULT_MAPPED_BAND_ROWS;
+    band_rows = band_rows < height ? band_rows : height;
+    SplatSource source = {rgb, depth, NULL, NULL, options->depth_format, width, height};
+    const RgbToShKernelInfo* kernel = prepare_conversion(context, options, &source, band_rows);
+    if (!kernel) {
+        return -1;
+    }
+
+    char header[PLY_HEADER_CAPACITY];
+    int count_digits = STREAM_COUNT_DIGITS;
+    int header_length = format_play_canvas_header(header, 0, PRECISION_FLOAT, count_digits, options->comments);
+    while (header_length % alignof(Splat) != 0) {
+        header_length = format_play_canvas_header(header, 0, PRECISION_FLOAT, ++count_digits, options->comments);
+    }
+
+    int fd = fileno(file);
+    size_t mapped_size = header_length + (size_t)width * height * sizeof(Splat);
+    if (ftruncate(fd, (off_t)mapped_size) != 0) {
+        return -1;
+    }
+    char* mapped = (char*)mmap(NULL, mapped_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mapped == MAP_FAILED) {
+        return -1;
+    }
+
+    SplatWriter writer;
+    SplatTransform transform;
+    splat_writer_init_mapped(&writer, (Splat*)(mapped + header_length));
+    if (resolve_transform(options, width, height, &transform)) {
+        writer.transform = &transform;
+    }
+    write_splat_bands(context, &source, band_rows, kernel->kernel, options->num_threads, &writer);
+    *num_splats = (int)splat_writer_finish(&writer);
+
+    format_play_canvas_header(header, *num_splats, PRECISION_FLOAT, count_digits, options->comments);
+    memcpy(mapped, header, header_length);
+
+    long long bytes_written = header_length + *num_splats * (long long)sizeof(Splat);
+    if (munmap(mapped, mapped_size) != 0 || ftruncate(fd, (off_t)bytes_written) != 0) {
+        return -1;
+    }
+    return bytes_written;
+}
+
+long long splatinit_encode_ply(const Splat* splats, int num_splats, const SplatinitOptions* options, FILE* file) {
+    SplatinitEncoder* encoder = splatinit_encoder_create(options, file);
+    if (!encoder) {
+        return -1;
+    }
+    encoder->failed = begin_encoder(encoder, num_splats) != 0;
+    splatinit_encoder_write(encoder, splats, num_splats);
+    return splatinit_encoder_finish(encoder, NULL);
+}
+
+int splatinit_color_kernel_supported(const char* name) {
+    return select_rgb_to_sh_kernel(name) != NULL;
+}
+
+// Reports how far every kernel is from the rgb2_sh() path, too
+void splatinit_benchmark_color_kernels(const uint8_t* image_data, int num_pixels) {
+    float* reference_block = (float*)malloc((size_t)num_pixels * 3 * sizeof(float));
+    float* colors_block = (float*)malloc((size_t)num_pixels * 3 * sizeof(float));
+    float* const reference[3] = {reference_block, reference_block + num_pixels, reference_block + 2 * num_pixels};
+    float* const colors[3] = {colors_block, colors_block + num_pixels, colors_block + 2 * num_pixels};
+    rgb_to_sh_scalar(image_data, reference, num_pixels);
+
+    // Enough passes for roughly a billion converted values, whatever the image size
+    int passes = (int)(1e9 / ((double)num_pixels * 3)) + 1;
+    double scalar_seconds = 0.0;
+    const RgbToShKernelInfo* fastest = select_rgb_to_sh_kernel("auto");
+    printf("Color kernel benchmark, %d pixels x %d passes (auto selects %s):\n", num_pixels, passes,
+           fastest ? fastest->name : "none");
+    for (int k = 0; k < NUM_RGB_TO_SH_KERNELS; k++) {
+        const RgbToShKernelInfo* info = &RGB_TO_SH_KERNELS[k];
+        if (!rgb_to_sh_kernel_supported(info->name)) {
+            printf("  %-8s not supported on this CPU\n", info->name);
+            continue;
+        }
+
+        info->kernel(image_data, colors, num_pixels);
+        double start = wall_time_seconds();
+        for (int pass = 0; pass < passes; pass++) {
+            info->kernel(image_data, colors, num_pixels);
+        }
+        double seconds = wall_time_seconds() - start;
+        if (k == 0) {
+            scalar_seconds = seconds;
+        }
+
+        float max_error = 0.0f;
+        for (int i = 0; i < num_pixels * 3; i++) {
+            float error = fabsf(colors_block[i] - reference_block[i]);
+            max_error = error > max_error ? error : max_error;
+        }
+        printf("  %-8s %7.3f ns/pixel %8.1f Mpixel/s %6.2fx  max error %g\n", info->name,
+               seconds * 1e9 / ((double)num_pixels * passes), (double)num_pixels * passes / seconds / 1e6,
+               scalar_seconds / seconds, max_error);
+    }
+
+    free(colors_block);
+    free(reference_block);
+}
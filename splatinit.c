@@ -5,91 +5,1463 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <stdarg.h>
 #include <getopt.h>
+#include <glob.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "splatinit.h"
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
-#define FLAT 0
-#define GLOBAL_SCALE 1
 #define OUTPUT_DIR "/tmp/splatting/"
 #define OUTPUT_PLY_NAME "output.ply"
+#define OUTPUT_SPLAT_NAME "output.splat"
+#define DEFAULT_STREAM_BAND_ROWS 64
+#define DEFAULT_KEYFRAME_INTERVAL 30
+// Frames in flight in the pipeline: one per stage and one waiting between two of them
+#define DEFAULT_PIPELINE_FRAMES 4
+
+// Options that only have a long form
+enum {
+    OPTION_FX = 256,
+    OPTION_FY,
+    OPTION_CX,
+    OPTION_CY,
+    OPTION_FORMAT,
+    OPTION_PRECISION,
+    OPTION_PIPELINE_FRAMES
+};
+
+double wall_time_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
 
-const char* PLAY_CANVAS_PLY_HEADER = "ply\n"
-                                     "format binary_little_endian 1.0\n"
-                                     "element vertex %d\n"
-                                     "property float x\n"
-                                     "property float y\n"
-                                     "property float z\n"
-                                     "property float f_dc_0\n"
-                                     "property float f_dc_1\n"
-                                     "property float f_dc_2\n"
-                                     "property float opacity\n"
-                                     "property float rot_0\n"
-                                     "property float rot_1\n"
-                                     "property float rot_2\n"
-                                     "property float rot_3\n"
-                                     "property float scale_0\n"
-                                     "property float scale_1\n"
-                                     "property float scale_2\n"
-                                     "end_header\n";
-
-const float C0 = 0.28209479177387814f;
+// One image of a batch and the PLY file it is converted into
+typedef struct {
+    char* image_path;
+    char* depth_map_path; // NULL when the image has no depth map
+    char* output_path;
+} BatchItem;
 
 typedef struct {
-    float packed_position[3];
-    float packed_color[3];
-    float opacity;
-    float packed_rotation[4];
-    float packed_scale[3];
-} Splat;
+    BatchItem* items;
+    int num_items;
+    int capacity;
+} BatchList;
 
-void rgb2_sh(float rgb[3], float sh[3]) {
-    for (int i = 0; i < 3; i++) {
-        sh[i] = (rgb[i] - 0.5f) / C0;
+void batch_list_free(BatchList* list) {
+    for (int i = 0; i < list->num_items; i++) {
+        free(list->items[i].image_path);
+        free(list->items[i].depth_map_path);
+        free(list->items[i].output_path);
     }
+    free(list->items);
+    list->items = NULL;
+    list->num_items = 0;
+    list->capacity = 0;
+}
+
+// Path of the file an image is converted into: the image's file name with the extension, such as .ply, in
+// output_dir
+void batch_output_path(const char* output_dir, const char* image_path, const char* extension, char* path,
+                       size_t size) {
+    const char* name = strrchr(image_path, '/') ? strrchr(image_path, '/') + 1 : image_path;
+    const char* image_extension = strrchr(name, '.');
+    int name_length = image_extension && image_extension != name ? (int)(image_extension - name) : (int)strlen(name);
+    size_t dir_length = strlen(output_dir);
+    const char* separator = dir_length > 0 && output_dir[dir_length - 1] != '/' ? "/" : "";
+    snprintf(path, size, "%s%s%.*s%s", output_dir, separator, name_length, name, extension);
 }
 
-int encode_splats_play_canvas_format(Splat* splats, int num_splats, int coalesced_num_splats, FILE* file) {
-    char header[1024];
-    sprintf(header, PLAY_CANVAS_PLY_HEADER, coalesced_num_splats);
-    fwrite(header, 1, strlen(header), file);
+// Path of the PLY file of a frame of an animation converted into output_path: output_path itself for a
+// single frame, else output_path with the frame number before its extension, as in output_00003.ply
+void frame_output_path(const char* output_path, int frame, int num_frames, char* path, size_t size) {
+    const char* name = strrchr(output_path, '/') ? strrchr(output_path, '/') + 1 : output_path;
+    const char* extension = strrchr(name, '.');
+    if (num_frames <= 1) {
+        snprintf(path, size, "%s", output_path);
+    } else if (extension && extension != name) {
+        snprintf(path, size, "%.*s_%05d%s", (int)(extension - output_path), output_path, frame, extension);
+    } else {
+        snprintf(path, size, "%s_%05d", output_path, frame);
+    }
+}
 
-    for (int i = 0; i < num_splats; i++) {
-        if (splats[i].opacity != 0.0f) {
-            fwrite(&splats[i], sizeof(Splat), 1, file);
+int batch_list_add(BatchList* list, const char* image_path, const char* depth_map_path, const char* output_path) {
+    if (list->num_items == list->capacity) {
+        int capacity = list->capacity ? list->capacity * 2 : 64;
+        BatchItem* items = (BatchItem*)realloc(list->items, capacity * sizeof(BatchItem));
+        if (!items) {
+            return -1;
         }
+        list->items = items;
+        list->capacity = capacity;
     }
+    BatchItem* item = &list->items[list->num_items];
+    item->image_path = strdup(image_path);
+    item->depth_map_path = depth_map_path ? strdup(depth_map_path) : NULL;
+    item->output_path = strdup(output_path);
+    if (!item->image_path || (depth_map_path && !item->depth_map_path) || !item->output_path) {
+        free(item->image_path);
+        free(item->depth_map_path);
+        free(item->output_path);
+        return -1;
+    }
+    list->num_items++;
+    return 0;
+}
 
-    return ftell(file);
+int compare_output_paths(const void* a, const void* b) {
+    return strcmp((*(const BatchItem* const*)a)->output_path, (*(const BatchItem* const*)b)->output_path);
+}
+
+// Output paths are named after the images' file names without their extensions, so images such as a.png
+// and a.jpg, or frames numbered by directory like 7/rgb.png, would be converted into the same file, by two
+// workers at once. Returns 0 when every output path is distinct, or -1 after reporting two images that
+// share one.
+int check_output_paths(const BatchList* list) {
+    if (list->num_items < 2) {
+        return 0;
+    }
+    const BatchItem** sorted = (const BatchItem**)malloc(list->num_items * sizeof(BatchItem*));
+    if (!sorted) {
+        printf("Failed to allocate memory for the batch.\n");
+        return -1;
+    }
+    for (int i = 0; i < list->num_items; i++) {
+        sorted[i] = &list->items[i];
+    }
+    qsort(sorted, list->num_items, sizeof(BatchItem*), compare_output_paths);
+    int result = 0;
+    for (int i = 1; i < list->num_items && result == 0; i++) {
+        if (strcmp(sorted[i - 1]->output_path, sorted[i]->output_path) == 0) {
+            printf("Both %s and %s would be converted into %s.\n", sorted[i - 1]->image_path, sorted[i]->image_path,
+                   sorted[i]->output_path);
+            result = -1;
+        }
+    }
+    free(sorted);
+    return result;
+}
+
+// Fills the list from a directory (every image in it), a glob pattern such as 'frames/*.png', or a list
+// file with one image path per line, optionally followed by its depth map path. Blank lines and lines
+// starting with # are skipped. Every image is converted into output_dir with the extension, and no two
+// images may share an output path. Returns 0, or -1 after reporting the problem.
+int read_batch_list(const char* path, const char* output_dir, const char* extension, BatchList* list) {
+    struct stat path_stat;
+    int is_directory = stat(path, &path_stat) == 0 && S_ISDIR(path_stat.st_mode);
+    if (is_directory || strpbrk(path, "*?[")) {
+        char pattern[4096];
+        snprintf(pattern, sizeof(pattern), is_directory ? "%s/*" : "%s", path);
+        char output_path[4096];
+        glob_t matches;
+        if (glob(pattern, 0, NULL, &matches) != 0) {
+            printf("No images match %s.\n", path);
+            return -1;
+        }
+        for (size_t i = 0; i < matches.gl_pathc; i++) {
+            const char* image_path = matches.gl_pathv[i];
+            int width, height, channels;
+            if (stat(image_path, &path_stat) != 0 || !S_ISREG(path_stat.st_mode) ||
+                (is_directory && !stbi_info(image_path, &width, &height, &channels))) {
+                continue;
+            }
+            batch_output_path(output_dir, image_path, extension, output_path, sizeof(output_path));
+            if (batch_list_add(list, image_path, NULL, output_path) != 0) {
+                globfree(&matches);
+                printf("Failed to allocate memory for the batch.\n");
+                return -1;
+            }
+        }
+        globfree(&matches);
+        return check_output_paths(list);
+    }
+
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        printf("Failed to open batch list %s.\n", path);
+        return -1;
+    }
+    char line[8192];
+    char image_path[4096];
+    char depth_map_path[4096];
+    char output_path[4096];
+    while (fgets(line, sizeof(line), file)) {
+        int fields = sscanf(line, "%4095s %4095s", image_path, depth_map_path);
+        if (fields < 1 || image_path[0] == '#') {
+            continue;
+        }
+        batch_output_path(output_dir, image_path, extension, output_path, sizeof(output_path));
+        if (batch_list_add(list, image_path, fields == 2 ? depth_map_path : NULL, output_path) != 0) {
+            fclose(file);
+            printf("Failed to allocate memory for the batch.\n");
+            return -1;
+        }
+    }
+    fclose(file);
+    return check_output_paths(list);
+}
+
+// The frames of an image, a single one unless it is an animated GIF, one after the other in image_data.
+// The depth map applies to every frame.
+typedef struct {
+    unsigned char* image_data;
+    void* depth_data; // NULL without a depth map
+    DepthFormat depth_format;
+    void* depth_mapping; // The mapped file depth_data points into, NULL when it was decoded
+    size_t depth_mapping_size;
+    int width;
+    int height;
+    int num_frames;
+    int* delays; // Display time of every frame in milliseconds, NULL unless animated
+} DecodedImage;
+
+// Whether pattern holds exactly one integer conversion such as %d or %05d, besides any %%, so it can
+// safely be formatted with a frame number
+int valid_frame_pattern(const char* pattern) {
+    int conversions = 0;
+    for (const char* c = strchr(pattern, '%'); c; c = strchr(c + 1, '%')) {
+        if (c[1] == '%') {
+            c++;
+            continue;
+        }
+        c++;
+        while (*c >= '0' && *c <= '9') {
+            c++;
+        }
+        if (*c != 'd' && *c != 'i' && *c != 'u') {
+            return 0;
+        }
+        conversions++;
+    }
+    return conversions == 1;
+}
+
+int file_exists(const char* path) {
+    struct stat path_stat;
+    return stat(path, &path_stat) == 0;
+}
+
+// Fills the list with the frames of a numbered sequence, each image path being image_pattern formatted
+// with the frame number and its depth map, if any, depth_pattern formatted with the same number. The
+// sequence starts at first_frame, or at 0 or 1, whichever exists, when first_frame is negative. It ends at
+// last_frame, or before the first missing frame when last_frame is negative. Returns 0, or -1 after
+// reporting the problem, such as two frames sharing an output path.
+int read_sequence_list(const char* image_pattern, const char* depth_pattern, int first_frame, int last_frame,
+                       const char* output_dir, const char* extension, BatchList* list) {
+    if (!valid_frame_pattern(image_pattern) || (depth_pattern && !valid_frame_pattern(depth_pattern))) {
+        printf("A sequence pattern needs exactly one frame number conversion such as %%05d.\n");
+        return -1;
+    }
+
+    char image_path[4096];
+    char depth_map_path[4096];
+    char output_path[4096];
+    if (first_frame < 0) {
+        snprintf(image_path, sizeof(image_path), image_pattern, 0);
+        first_frame = file_exists(image_path) ? 0 : 1;
+    }
+    for (int frame = first_frame; last_frame < 0 || frame <= last_frame; frame++) {
+        snprintf(image_path, sizeof(image_path), image_pattern, frame);
+        if (last_frame < 0 && !file_exists(image_path)) {
+            break;
+        }
+        if (depth_pattern) {
+            snprintf(depth_map_path, sizeof(depth_map_path), depth_pattern, frame);
+        }
+        batch_output_path(output_dir, image_path, extension, output_path, sizeof(output_path));
+        if (batch_list_add(list, image_path, depth_pattern ? depth_map_path : NULL, output_path) != 0) {
+            printf("Failed to allocate memory for the batch.\n");
+            return -1;
+        }
+    }
+    if (list->num_items == 0) {
+        printf("No frames match %s.\n", image_pattern);
+        return -1;
+    }
+    return check_output_paths(list);
+}
+
+size_t depth_sample_size(DepthFormat format) {
+    return format == DEPTH_F32 ? sizeof(float) : format == DEPTH_U16 ? sizeof(uint16_t) : 1;
+}
+
+// Layout of headerless depth files: width x height samples of format, row by row
+typedef struct {
+    int width;
+    int height;
+    DepthFormat format;
+} RawDepthLayout;
+
+// Parses the header of a .npy file holding a C ordered array of shape (height, width) or (height, width,
+// 1) of little-endian uint8, uint16 or float32 samples. Returns the offset of the samples, or -1.
+long parse_npy_header(const unsigned char* data, size_t size, RawDepthLayout* layout) {
+    if (size < 12 || memcmp(data, "\x93NUMPY", 6) != 0) {
+        return -1;
+    }
+    size_t header_start = data[6] == 1 ? 10 : 12;
+    size_t header_length = data[6] == 1 ? (size_t)(data[8] | data[9] << 8)
+                                        : (size_t)data[8] | (size_t)data[9] << 8 | (size_t)data[10] << 16 |
+                                          (size_t)data[11] << 24;
+    char header[4096];
+    if (header_length >= sizeof(header) || header_start + header_length > size) {
+        return -1;
+    }
+    memcpy(header, &data[header_start], header_length);
+    header[header_length] = '\0';
+
+    const char* descr = strstr(header, "'descr':");
+    const char* shape = strstr(header, "'shape':");
+    char type[8];
+    int channels = 1;
+    if (!descr || !shape || !strstr(header, "'fortran_order': False") ||
+        sscanf(descr, "'descr': '%7[^']'", type) != 1 ||
+        sscanf(shape, "'shape': (%d, %d, %d)", &layout->height, &layout->width, &channels) < 2 || channels != 1) {
+        return -1;
+    }
+    if (strcmp(type, "<f4") == 0) {
+        layout->format = DEPTH_F32;
+    } else if (strcmp(type, "<u2") == 0) {
+        layout->format = DEPTH_U16;
+    } else if (strcmp(type, "|u1") == 0 || strcmp(type, "<u1") == 0) {
+        layout->format = DEPTH_U8;
+    } else {
+        return -1;
+    }
+    return (long)(header_start + header_length);
+}
+
+// Maps a .npy file, or a headerless file of the raw layout, so the depths are read in place during splat
+// generation rather than decoded or copied. Returns 0, or -1 after reporting the problem.
+int map_depth_file(const char* path, const RawDepthLayout* raw, DecodedImage* image) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    struct stat file_stat;
+    void* mapping = fstat(fd, &file_stat) == 0 && file_stat.st_size > 0
+            ? mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0)
+            : MAP_FAILED;
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        return -1;
+    }
+    size_t size = file_stat.st_size;
+
+    RawDepthLayout layout = {0, 0, DEPTH_U8};
+    long offset = raw ? 0 : parse_npy_header((const unsigned char*)mapping, size, &layout);
+    if (raw) {
+        layout = *raw;
+    } else if (offset < 0) {
+        printf("%s is not a .npy file of a single channel of uint8, uint16 or float32 depths.\n", path);
+    }
+    size_t sample_size = depth_sample_size(layout.format);
+    if (offset < 0 || offset % sample_size != 0 ||
+        size < offset + (size_t)layout.width * layout.height * sample_size ||
+        layout.width != image->width || layout.height != image->height) {
+        munmap(mapping, size);
+        return -1;
+    }
+    posix_madvise(mapping, size, POSIX_MADV_SEQUENTIAL);
+    image->depth_data = (unsigned char*)mapping + offset;
+    image->depth_format = layout.format;
+    image->depth_mapping = mapping;
+    image->depth_mapping_size = size;
+    return 0;
+}
+
+// Loads the depth map of an image at its full precision: 16-bit images as 16-bit samples, HDR images as
+// floats, and .npy files and headerless files, when raw is set, memory mapped. Returns 0, or -1 when it
+// cannot be loaded or its size differs from the image's.
+int load_depth_map(const char* path, const RawDepthLayout* raw, DecodedImage* image) {
+    const char* extension = strrchr(path, '.');
+    if (raw || (extension && strcmp(extension, ".npy") == 0)) {
+        return map_depth_file(path, extension && strcmp(extension, ".npy") == 0 ? NULL : raw, image);
+    }
+
+    int width, height, channels;
+    if (stbi_is_hdr(path)) {
+        image->depth_format = DEPTH_F32;
+        image->depth_data = stbi_loadf(path, &width, &height, &channels, 1);
+    } else if (stbi_is_16_bit(path)) {
+        image->depth_format = DEPTH_U16;
+        image->depth_data = stbi_load_16(path, &width, &height, &channels, 1);
+    } else {
+        image->depth_format = DEPTH_U8;
+        image->depth_data = stbi_load(path, &width, &height, &channels, 1);
+    }
+    if (image->depth_data && (width != image->width || height != image->height)) {
+        stbi_image_free(image->depth_data);
+        image->depth_data = NULL;
+    }
+    return image->depth_data ? 0 : -1;
+}
+
+void decoded_image_free(DecodedImage* image) {
+    if (image->image_data) {
+        stbi_image_free(image->image_data);
+    }
+    if (image->depth_data && image->depth_mapping) {
+        munmap(image->depth_mapping, image->depth_mapping_size);
+    } else if (image->depth_data) {
+        stbi_image_free(image->depth_data);
+    }
+    free(image->delays);
+    image->image_data = NULL;
+    image->depth_data = NULL;
+    image->depth_mapping = NULL;
+    image->delays = NULL;
+}
+
+int is_gif(const char* path) {
+    char magic[4];
+    FILE* file = fopen(path, "rb");
+    int gif = file && fread(magic, 1, 4, file) == 4 && memcmp(magic, "GIF8", 4) == 0;
+    if (file) {
+        fclose(file);
+    }
+    return gif;
+}
+
+// Decodes every frame of an animated GIF at once. Returns the frames, or NULL.
+unsigned char* load_gif_frames(const char* path, DecodedImage* image) {
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        return NULL;
+    }
+    unsigned char* frames = NULL;
+    long length = fseek(file, 0, SEEK_END) == 0 ? ftell(file) : -1;
+    unsigned char* buffer = length > 0 && length <= INT32_MAX ? (unsigned char*)malloc(length) : NULL;
+    if (buffer && fseek(file, 0, SEEK_SET) == 0 && fread(buffer, 1, length, file) == (size_t)length) {
+        int channels;
+        frames = stbi_load_gif_from_memory(buffer, (int)length, &image->delays, &image->width, &image->height,
+                                           &image->num_frames, &channels, 3);
+    }
+    if (!frames || image->num_frames < 2) {
+        // stb_image frees the delays when it fails but leaves the pointer set
+        if (frames) {
+            free(image->delays);
+        }
+        image->delays = NULL;
+        image->num_frames = 1;
+    }
+    free(buffer);
+    fclose(file);
+    return frames;
+}
+
+// Decodes the image of item, every frame of it for an animated GIF, and loads its depth map, headerless
+// when raw_depth is set. Returns 0, or -1 after reporting the failure.
+int decode_batch_item(const BatchItem* item, const RawDepthLayout* raw_depth, DecodedImage* image) {
+    int channels;
+    image->depth_data = NULL;
+    image->depth_format = DEPTH_U8;
+    image->depth_mapping = NULL;
+    image->num_frames = 1;
+    image->delays = NULL;
+    image->image_data = is_gif(item->image_path)
+            ? load_gif_frames(item->image_path, image)
+            : stbi_load(item->image_path, &image->width, &image->height, &channels, 3);
+    if (!image->image_data) {
+        printf("Failed to load image %s.\n", item->image_path);
+        return -1;
+    }
+    if (item->depth_map_path && load_depth_map(item->depth_map_path, raw_depth, image) != 0) {
+        printf("Failed to load depth map %s or dimensions mismatch.\n", item->depth_map_path);
+        decoded_image_free(image);
+        return -1;
+    }
+    return 0;
+}
+
+// Comment naming the display time of a frame of an animation, empty for a still image
+void format_frame_delay(const DecodedImage* image, int frame, char* comments, size_t size) {
+    if (image->delays) {
+        snprintf(comments, size, "splatinit frame delay %d ms", image->delays[frame]);
+    } else if (size > 0) {
+        comments[0] = '\0';
+    }
+}
+
+// Decodes the image of item and writes its PLY file, or one per frame of an animated GIF. Returns the
+// number of bytes written, or -1 after reporting the failure.
+long long convert_batch_item(SplatinitContext* context, const BatchItem* item, const SplatinitOptions* options,
+                             const RawDepthLayout* raw_depth, int mmap_output, int* num_splats) {
+    DecodedImage image;
+    if (decode_batch_item(item, raw_depth, &image) != 0) {
+        return -1;
+    }
+
+    long long bytes_written = 0;
+    *num_splats = 0;
+    size_t frame_size = (size_t)image.width * image.height * 3;
+    for (int f = 0; f < image.num_frames && bytes_written >= 0; f++) {
+        char output_path[4096];
+        char comments[64];
+        frame_output_path(item->output_path, f, image.num_frames, output_path, sizeof(output_path));
+        format_frame_delay(&image, f, comments, sizeof(comments));
+        SplatinitOptions frame_options = *options;
+        frame_options.comments = image.delays ? comments : options->comments;
+        frame_options.depth_format = image.depth_format;
+        const unsigned char* frame_data = image.image_data + f * frame_size;
+
+        long long frame_bytes = -1;
+        int frame_splats = 0;
+        FILE* file = fopen(output_path, mmap_output ? "w+b" : "wb");
+        if (file) {
+            frame_bytes = mmap_output
+                    ? splatinit_write_ply_mapped(context, frame_data, image.depth_data, image.width, image.height,
+                                                 &frame_options, file, &frame_splats)
+                    : splatinit_write_ply(context, frame_data, image.depth_data, image.width, image.height,
+                                          &frame_options, file, &frame_splats);
+            if (fclose(file) != 0) {
+                frame_bytes = -1;
+            }
+        }
+        if (frame_bytes < 0) {
+            printf("Failed to write output file %s.\n", output_path);
+            bytes_written = -1;
+        } else {
+            bytes_written += frame_bytes;
+            *num_splats += frame_splats;
+        }
+    }
+
+    decoded_image_free(&image);
+    return bytes_written;
+}
+
+// Shared state of the batch workers. Each worker takes the next unconverted item until none are left.
+typedef struct {
+    const BatchList* list;
+    const SplatinitOptions* options;
+    const RawDepthLayout* raw_depth; // NULL unless depth maps are headerless
+    int mmap_output;
+    pthread_mutex_t mutex;
+    int next_item;
+    int num_converted;
+    long long num_splats;
+    long long bytes_written;
+} BatchRun;
+
+void* batch_worker(void* arg) {
+    BatchRun* run = (BatchRun*)arg;
+    // The context, and with it every splat buffer, is reused for all the images this worker converts
+    SplatinitContext* context = splatinit_create();
+    if (!context) {
+        printf("Failed to allocate memory for splats.\n");
+        return NULL;
+    }
+
+    for (;;) {
+        pthread_mutex_lock(&run->mutex);
+        int index = run->next_item++;
+        pthread_mutex_unlock(&run->mutex);
+        if (index >= run->list->num_items) {
+            break;
+        }
+
+        int num_splats = 0;
+        long long bytes_written = convert_batch_item(context, &run->list->items[index], run->options,
+                                                     run->raw_depth, run->mmap_output, &num_splats);
+        if (bytes_written >= 0) {
+            pthread_mutex_lock(&run->mutex);
+            run->num_converted++;
+            run->num_splats += num_splats;
+            run->bytes_written += bytes_written;
+            pthread_mutex_unlock(&run->mutex);
+        }
+    }
+
+    splatinit_destroy(context);
+    return NULL;
+}
+
+void print_batch_throughput(int num_converted, long long bytes_written, double seconds) {
+    printf("Bytes written: %lld\n", bytes_written);
+    printf("Write throughput: %.1f MB/s\n", seconds > 0.0 ? bytes_written / seconds / 1e6 : 0.0);
+    printf("Images per second: %.1f\n", seconds > 0.0 ? num_converted / seconds : 0.0);
+    printf("Execution time: %.2f seconds\n", seconds);
+}
+
+// Converts every item of the list on num_workers threads and reports the aggregate throughput. Returns 0
+// when every image was converted.
+int run_batch(const BatchList* list, const SplatinitOptions* options, const RawDepthLayout* raw_depth,
+              int mmap_output, int num_workers) {
+    if (num_workers > list->num_items) {
+        num_workers = list->num_items;
+    }
+    if (num_workers < 1) {
+        num_workers = 1;
+    }
+
+    BatchRun run = {list, options, raw_depth, mmap_output, PTHREAD_MUTEX_INITIALIZER, 0, 0, 0, 0};
+    pthread_t* workers = (pthread_t*)malloc(num_workers * sizeof(pthread_t));
+    int* started = (int*)calloc(num_workers, sizeof(int));
+    if (!workers || !started) {
+        free(workers);
+        free(started);
+        printf("Failed to allocate memory for the batch.\n");
+        return 1;
+    }
+
+    // The calling thread works too; workers that cannot be spawned are simply left out
+    double start_time = wall_time_seconds();
+    for (int w = 1; w < num_workers; w++) {
+        started[w] = pthread_create(&workers[w], NULL, batch_worker, &run) == 0;
+    }
+    batch_worker(&run);
+    for (int w = 1; w < num_workers; w++) {
+        if (started[w]) {
+            pthread_join(workers[w], NULL);
+        }
+    }
+    double seconds = wall_time_seconds() - start_time;
+    free(started);
+    free(workers);
+
+    printf("Converted %d of %d images into %lld splats on %d workers\n", run.num_converted, list->num_items,
+           run.num_splats, num_workers);
+    print_batch_throughput(run.num_converted, run.bytes_written, seconds);
+    return run.num_converted == list->num_items ? 0 : 1;
+}
+
+// An image on its way through the pipeline. The splat buffer stays allocated when the frame is recycled,
+// so it only grows while the pipeline runs: every frame in flight holds all the splats of its image, 56
+// bytes each before the writer encodes them.
+typedef struct {
+    const BatchItem* item;
+    DecodedImage image;
+    char output_path[4096]; // The item's, numbered for a frame of an animation
+    Splat* splats;
+    int num_splats;
+    int capacity;
+    char comments[1024]; // Header comments of the output file
+    int failed;
+} PipelineFrame;
+
+// Bounded blocking FIFO of frames between two stages
+typedef struct {
+    PipelineFrame** frames;
+    int capacity; // Every frame of the pipeline fits, so pushing back a frame that was popped never blocks
+    int head;
+    int count;
+    int closed;
+    pthread_mutex_t mutex;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+} FrameQueue;
+
+int frame_queue_init(FrameQueue* queue, int capacity) {
+    queue->frames = (PipelineFrame**)malloc(capacity * sizeof(PipelineFrame*));
+    queue->capacity = capacity;
+    queue->head = 0;
+    queue->count = 0;
+    queue->closed = 0;
+    pthread_mutex_init(&queue->mutex, NULL);
+    pthread_cond_init(&queue->not_empty, NULL);
+    pthread_cond_init(&queue->not_full, NULL);
+    return queue->frames ? 0 : -1;
+}
+
+void frame_queue_destroy(FrameQueue* queue) {
+    free(queue->frames);
+    pthread_mutex_destroy(&queue->mutex);
+    pthread_cond_destroy(&queue->not_empty);
+    pthread_cond_destroy(&queue->not_full);
+}
+
+void frame_queue_push(FrameQueue* queue, PipelineFrame* frame) {
+    pthread_mutex_lock(&queue->mutex);
+    while (queue->count == queue->capacity) {
+        pthread_cond_wait(&queue->not_full, &queue->mutex);
+    }
+    queue->frames[(queue->head + queue->count++) % queue->capacity] = frame;
+    pthread_cond_signal(&queue->not_empty);
+    pthread_mutex_unlock(&queue->mutex);
+}
+
+// Blocks until a frame is available. Returns NULL once the queue is closed and drained.
+PipelineFrame* frame_queue_pop(FrameQueue* queue) {
+    pthread_mutex_lock(&queue->mutex);
+    while (queue->count == 0 && !queue->closed) {
+        pthread_cond_wait(&queue->not_empty, &queue->mutex);
+    }
+    PipelineFrame* frame = NULL;
+    if (queue->count > 0) {
+        frame = queue->frames[queue->head];
+        queue->head = (queue->head + 1) % queue->capacity;
+        queue->count--;
+        pthread_cond_signal(&queue->not_full);
+    }
+    pthread_mutex_unlock(&queue->mutex);
+    return frame;
+}
+
+void frame_queue_close(FrameQueue* queue) {
+    pthread_mutex_lock(&queue->mutex);
+    queue->closed = 1;
+    pthread_cond_broadcast(&queue->not_empty);
+    pthread_mutex_unlock(&queue->mutex);
+}
+
+// Decodes, converts and writes the images of a batch on one thread per stage, so that while one image is
+// converted the next one is decoded and the previous one written. Frames move from stage to stage through
+// bounded queues and return to the decoder once written. Every stage handles the frames in order, so in
+// delta mode the converter can compare each frame against the one before it.
+typedef struct {
+    const BatchList* list;
+    const SplatinitOptions* options;
+    const RawDepthLayout* raw_depth;
+    int delta;
+    int keyframe_interval; // Frames from one keyframe to the next in delta mode
+    int num_keyframes;
+    FrameQueue free_frames;
+    FrameQueue decoded;
+    FrameQueue converted;
+    double decode_seconds; // Time each stage spent working rather than waiting
+    double convert_seconds;
+    double write_seconds;
+    int num_frames; // Frames decoded, more than the items when they include animations
+    int num_converted;
+    long long num_splats;
+    long long bytes_written;
+} Pipeline;
+
+// Appends a line to the header comments of the frame
+void add_frame_comment(PipelineFrame* frame, const char* format, ...) {
+    size_t length = strlen(frame->comments);
+    if (length > 0 && length + 1 < sizeof(frame->comments)) {
+        frame->comments[length++] = '\n';
+        frame->comments[length] = '\0';
+    }
+    va_list args;
+    va_start(args, format);
+    vsnprintf(&frame->comments[length], sizeof(frame->comments) - length, format, args);
+    va_end(args);
+}
+
+// Copies frame f of an animation, and the depth map, into an image of its own. Returns 0, or -1 after
+// reporting the failure.
+int copy_animation_frame(const DecodedImage* animation, int f, DecodedImage* image) {
+    size_t num_pixels = (size_t)animation->width * animation->height;
+    size_t depth_size = num_pixels * depth_sample_size(animation->depth_format);
+    image->width = animation->width;
+    image->height = animation->height;
+    image->depth_format = animation->depth_format;
+    image->depth_mapping = NULL;
+    image->num_frames = 1;
+    image->delays = NULL;
+    image->image_data = (unsigned char*)malloc(num_pixels * 3);
+    image->depth_data = animation->depth_data ? malloc(depth_size) : NULL;
+    if (!image->image_data || (animation->depth_data && !image->depth_data)) {
+        printf("Failed to allocate memory for a frame.\n");
+        decoded_image_free(image);
+        return -1;
+    }
+    memcpy(image->image_data, animation->image_data + f * num_pixels * 3, num_pixels * 3);
+    if (animation->depth_data) {
+        memcpy(image->depth_data, animation->depth_data, depth_size);
+    }
+    return 0;
+}
+
+// Decodes every item once and hands each of its frames to the converter, a single one unless the item
+// is an animated GIF
+void* pipeline_decode_stage(void* arg) {
+    Pipeline* pipeline = (Pipeline*)arg;
+    for (int i = 0; i < pipeline->list->num_items; i++) {
+        const BatchItem* item = &pipeline->list->items[i];
+        double start = wall_time_seconds();
+        DecodedImage image;
+        int failed = decode_batch_item(item, pipeline->raw_depth, &image) != 0;
+        int num_frames = failed ? 1 : image.num_frames;
+        pipeline->decode_seconds += wall_time_seconds() - start;
+        for (int f = 0; f < num_frames; f++) {
+            PipelineFrame* frame = frame_queue_pop(&pipeline->free_frames);
+            start = wall_time_seconds();
+            frame->item = item;
+            frame->comments[0] = '\0';
+            frame_output_path(item->output_path, f, num_frames, frame->output_path, sizeof(frame->output_path));
+            if (failed || num_frames > 1) {
+                frame->failed = failed || copy_animation_frame(&image, f, &frame->image) != 0;
+                if (!failed) {
+                    add_frame_comment(frame, "splatinit frame delay %d ms", image.delays[f]);
+                }
+            } else {
+                frame->failed = 0;
+                frame->image = image;
+                image.image_data = NULL;
+                image.depth_data = NULL;
+            }
+            pipeline->decode_seconds += wall_time_seconds() - start;
+            pipeline->num_frames++;
+            frame_queue_push(&pipeline->decoded, frame);
+        }
+        if (!failed) {
+            decoded_image_free(&image);
+        }
+    }
+    frame_queue_close(&pipeline->decoded);
+    return NULL;
+}
+
+int begin_frame_splats(void* user_data, int num_splats) {
+    PipelineFrame* frame = (PipelineFrame*)user_data;
+    frame->num_splats = 0;
+    if (num_splats > frame->capacity) {
+        Splat* splats = (Splat*)realloc(frame->splats, num_splats * sizeof(Splat));
+        if (!splats) {
+            return -1;
+        }
+        frame->splats = splats;
+        frame->capacity = num_splats;
+    }
+    return 0;
+}
+
+int append_frame_splats(void* user_data, const Splat* splats, int count) {
+    PipelineFrame* frame = (PipelineFrame*)user_data;
+    if (frame->num_splats + count > frame->capacity) {
+        // Converting in bands, the count was not known up front
+        int needed = frame->num_splats + count;
+        int capacity = frame->capacity * 2 > needed ? frame->capacity * 2 : needed;
+        Splat* grown = (Splat*)realloc(frame->splats, capacity * sizeof(Splat));
+        if (!grown) {
+            return -1;
+        }
+        frame->splats = grown;
+        frame->capacity = capacity;
+    }
+    memcpy(&frame->splats[frame->num_splats], splats, count * sizeof(Splat));
+    frame->num_splats += count;
+    return 0;
+}
+
+const char* file_name(const char* path) {
+    return strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+}
+
+// Converts the frames in order. In delta mode every frame but the keyframes only holds the splats of the
+// pixels that changed since the previous frame, and names its keyframe and previous frame in its header.
+// A keyframe starts every keyframe_interval frames, after a frame that failed, and whenever the size or
+// the presence or format of a depth map changes.
+void pipeline_convert_stage(Pipeline* pipeline) {
+    SplatinitContext* context = splatinit_create();
+    if (!context) {
+        printf("Failed to allocate memory for splats.\n");
+    }
+    DecodedImage previous = {NULL, NULL, DEPTH_U8, NULL, 0, 0, 0, 1, NULL};
+    char previous_name[4096] = "";
+    char keyframe_name[4096] = "";
+    int frames_since_keyframe = 0;
+
+    PipelineFrame* frame;
+    while ((frame = frame_queue_pop(&pipeline->decoded))) {
+        double start = wall_time_seconds();
+        DecodedImage* image = &frame->image;
+        if (!frame->failed) {
+            SplatinitSink sink = {begin_frame_splats, append_frame_splats, frame};
+            SplatinitOptions options = *pipeline->options;
+            options.depth_format = image->depth_format;
+            int keyframe = !previous.image_data || frames_since_keyframe >= pipeline->keyframe_interval ||
+                           previous.width != image->width || previous.height != image->height ||
+                           !previous.depth_data != !image->depth_data || previous.depth_format != image->depth_format;
+            if (!pipeline->delta || keyframe) {
+                frame->failed = !context || splatinit_convert(context, image->image_data, image->depth_data,
+                                                              image->width, image->height, &options, &sink) < 0;
+            } else {
+                frame->failed = !context || splatinit_convert_delta(context, image->image_data, image->depth_data,
+                                                                    previous.image_data, previous.depth_data,
+                                                                    image->width, image->height, &options,
+                                                                    &sink) < 0;
+            }
+            if (frame->failed) {
+                printf("Failed to convert image %s.\n", frame->item->image_path);
+            } else if (pipeline->delta && keyframe) {
+                add_frame_comment(frame, "splatinit keyframe");
+                snprintf(keyframe_name, sizeof(keyframe_name), "%s", file_name(frame->output_path));
+                frames_since_keyframe = 1;
+                pipeline->num_keyframes++;
+            } else if (pipeline->delta) {
+                add_frame_comment(frame, "splatinit delta: only the pixels changed since the previous frame\n"
+                                         "keyframe %s\nprevious %s", keyframe_name, previous_name);
+                frames_since_keyframe++;
+            }
+        }
+
+        // The previous frame is kept for the next delta; a failed frame forces a keyframe instead
+        decoded_image_free(&previous);
+        if (pipeline->delta && !frame->failed) {
+            previous = *image;
+            snprintf(previous_name, sizeof(previous_name), "%s", file_name(frame->output_path));
+            image->image_data = NULL;
+            image->depth_data = NULL;
+        } else {
+            decoded_image_free(image);
+        }
+        pipeline->convert_seconds += wall_time_seconds() - start;
+        frame_queue_push(&pipeline->converted, frame);
+    }
+    decoded_image_free(&previous);
+    frame_queue_close(&pipeline->converted);
+    splatinit_destroy(context);
+}
+
+void* pipeline_write_stage(void* arg) {
+    Pipeline* pipeline = (Pipeline*)arg;
+    PipelineFrame* frame;
+    while ((frame = frame_queue_pop(&pipeline->converted))) {
+        double start = wall_time_seconds();
+        if (!frame->failed) {
+            long long bytes_written = -1;
+            FILE* file = fopen(frame->output_path, "wb");
+            if (file) {
+                SplatinitOptions options = *pipeline->options;
+                options.comments = frame->comments;
+                bytes_written = splatinit_encode_ply(frame->splats, frame->num_splats, &options, file);
+                if (fclose(file) != 0) {
+                    bytes_written = -1;
+                }
+            }
+            if (bytes_written < 0) {
+                printf("Failed to write output file %s.\n", frame->output_path);
+            } else {
+                pipeline->num_converted++;
+                pipeline->num_splats += frame->num_splats;
+                pipeline->bytes_written += bytes_written;
+            }
+        }
+        pipeline->write_seconds += wall_time_seconds() - start;
+        frame_queue_push(&pipeline->free_frames, frame);
+    }
+    return NULL;
+}
+
+// Runs the batch through the pipeline, converting on the calling thread, and reports the aggregate
+// throughput and how busy each stage was. num_frames images are in flight at once, which bounds the
+// memory to that many decoded images and their splats. keyframe_interval is 0 unless converting deltas.
+// Returns 0 when every image was converted.
+int run_pipeline(const BatchList* list, const SplatinitOptions* options, const RawDepthLayout* raw_depth,
+                 int num_frames, int keyframe_interval) {
+    Pipeline pipeline;
+    memset(&pipeline, 0, sizeof(Pipeline));
+    pipeline.list = list;
+    pipeline.options = options;
+    pipeline.raw_depth = raw_depth;
+    pipeline.delta = keyframe_interval > 0;
+    pipeline.keyframe_interval = keyframe_interval;
+    int queues_ready = frame_queue_init(&pipeline.free_frames, num_frames) == 0;
+    queues_ready = frame_queue_init(&pipeline.decoded, num_frames) == 0 && queues_ready;
+    queues_ready = frame_queue_init(&pipeline.converted, num_frames) == 0 && queues_ready;
+    PipelineFrame* frames = (PipelineFrame*)calloc(num_frames, sizeof(PipelineFrame));
+    if (frames && queues_ready) {
+        for (int i = 0; i < num_frames; i++) {
+            frame_queue_push(&pipeline.free_frames, &frames[i]);
+        }
+    }
+
+    double start_time = wall_time_seconds();
+    pthread_t decoder;
+    pthread_t writer;
+    int result = 1;
+    if (!frames || !queues_ready) {
+        printf("Failed to allocate memory for the pipeline.\n");
+    } else if (pthread_create(&decoder, NULL, pipeline_decode_stage, &pipeline) != 0) {
+        printf("Failed to start the pipeline.\n");
+    } else {
+        if (pthread_create(&writer, NULL, pipeline_write_stage, &pipeline) != 0) {
+            // Without a writer the decoder stalls once every frame is in flight, so unblock it by draining
+            printf("Failed to start the pipeline.\n");
+            PipelineFrame* frame;
+            while ((frame = frame_queue_pop(&pipeline.decoded))) {
+                decoded_image_free(&frame->image);
+                frame_queue_push(&pipeline.free_frames, frame);
+            }
+            pthread_join(decoder, NULL);
+        } else {
+            pipeline_convert_stage(&pipeline);
+            pthread_join(decoder, NULL);
+            pthread_join(writer, NULL);
+            double seconds = wall_time_seconds() - start_time;
+
+            printf("Converted %d of %d images into %lld splats in a three-stage pipeline\n", pipeline.num_converted,
+                   pipeline.num_frames, pipeline.num_splats);
+            if (pipeline.delta) {
+                printf("Keyframes: %d, delta frames: %d\n", pipeline.num_keyframes,
+                       pipeline.num_converted - pipeline.num_keyframes);
+            }
+            printf("Busy time: decode %.2f s, convert %.2f s, write %.2f s\n", pipeline.decode_seconds,
+                   pipeline.convert_seconds, pipeline.write_seconds);
+            print_batch_throughput(pipeline.num_converted, pipeline.bytes_written, seconds);
+            result = pipeline.num_converted == pipeline.num_frames ? 0 : 1;
+        }
+    }
+
+    for (int i = 0; frames && i < num_frames; i++) {
+        free(frames[i].splats);
+    }
+    free(frames);
+    frame_queue_destroy(&pipeline.free_frames);
+    frame_queue_destroy(&pipeline.decoded);
+    frame_queue_destroy(&pipeline.converted);
+    return result;
+}
+
+// Reads a view list, one view of a capture per line: its image path, its depth map path and the twelve
+// numbers of its camera to world pose, each row of the rotation followed by its translation. Blank lines
+// and lines starting with # are skipped. Returns 0, or -1 after reporting the problem.
+int read_view_list(const char* path, const char* output_path, BatchList* list, CameraPose** poses) {
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        printf("Failed to open view list %s.\n", path);
+        return -1;
+    }
+    char line[8192];
+    char image_path[4096];
+    char depth_map_path[4096];
+    int line_number = 0;
+    while (fgets(line, sizeof(line), file)) {
+        CameraPose pose;
+        float (*m)[3] = pose.rotation;
+        float* t = pose.translation;
+        line_number++;
+        int fields = sscanf(line, "%4095s %4095s %f %f %f %f %f %f %f %f %f %f %f %f", image_path, depth_map_path,
+                            &m[0][0], &m[0][1], &m[0][2], &t[0], &m[1][0], &m[1][1], &m[1][2], &t[1], &m[2][0],
+                            &m[2][1], &m[2][2], &t[2]);
+        if (fields < 1 || image_path[0] == '#') {
+            continue;
+        }
+        if (fields != 14) {
+            printf("Line %d of %s is not an image, a depth map and a 3x4 pose.\n", line_number, path);
+            fclose(file);
+            return -1;
+        }
+        if (batch_list_add(list, image_path, depth_map_path, output_path) != 0) {
+            fclose(file);
+            printf("Failed to allocate memory for the views.\n");
+            return -1;
+        }
+        CameraPose* grown = (CameraPose*)realloc(*poses, list->capacity * sizeof(CameraPose));
+        if (!grown) {
+            fclose(file);
+            printf("Failed to allocate memory for the views.\n");
+            return -1;
+        }
+        *poses = grown;
+        (*poses)[list->num_items - 1] = pose;
+    }
+    fclose(file);
+    if (list->num_items == 0) {
+        printf("No views in %s.\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+// Shared state of the workers fusing the views of a capture into one file. Each worker converts the next
+// view into its own buffer, then appends it to the encoder once the views before it are written.
+typedef struct {
+    const BatchList* list;
+    const CameraPose* poses;
+    const SplatinitOptions* options;
+    const RawDepthLayout* raw_depth;
+    SplatinitEncoder* encoder;
+    pthread_mutex_t mutex;
+    pthread_cond_t view_written;
+    int next_view;
+    int next_write;
+    int num_converted;
+    long long num_splats;
+} FusionRun;
+
+void* fusion_worker(void* arg) {
+    FusionRun* run = (FusionRun*)arg;
+    SplatinitContext* context = splatinit_create();
+    if (!context) {
+        printf("Failed to allocate memory for splats.\n");
+    }
+    PipelineFrame buffer;
+    memset(&buffer, 0, sizeof(buffer));
+
+    for (;;) {
+        pthread_mutex_lock(&run->mutex);
+        int index = run->next_view++;
+        pthread_mutex_unlock(&run->mutex);
+        if (index >= run->list->num_items) {
+            break;
+        }
+
+        const BatchItem* item = &run->list->items[index];
+        DecodedImage image;
+        int converted = 0;
+        if (context && decode_batch_item(item, run->raw_depth, &image) == 0) {
+            SplatinitOptions options = *run->options;
+            options.depth_format = image.depth_format;
+            options.pose = &run->poses[index];
+            SplatinitSink sink = {begin_frame_splats, append_frame_splats, &buffer};
+            converted = splatinit_convert(context, image.image_data, image.depth_data, image.width, image.height,
+                                          &options, &sink) >= 0;
+            if (!converted) {
+                printf("Failed to convert image %s.\n", item->image_path);
+            }
+            decoded_image_free(&image);
+        }
+
+        // Writing in list order keeps the output the same however the views are spread over the workers
+        pthread_mutex_lock(&run->mutex);
+        while (run->next_write != index) {
+            pthread_cond_wait(&run->view_written, &run->mutex);
+        }
+        if (converted && splatinit_encoder_write(run->encoder, buffer.splats, buffer.num_splats) == 0) {
+            run->num_converted++;
+            run->num_splats += buffer.num_splats;
+        }
+        run->next_write++;
+        pthread_cond_broadcast(&run->view_written);
+        pthread_mutex_unlock(&run->mutex);
+    }
+
+    free(buffer.splats);
+    splatinit_destroy(context);
+    return NULL;
+}
+
+// Converts the views of the list on num_workers threads, each through its camera pose into world space,
+// and writes them all into the single file at output_path. Returns 0 when every view was fused.
+int run_fusion(const BatchList* list, const CameraPose* poses, const SplatinitOptions* options,
+               const RawDepthLayout* raw_depth, const char* output_path, int num_workers) {
+    if (num_workers > list->num_items) {
+        num_workers = list->num_items;
+    }
+    if (num_workers < 1) {
+        num_workers = 1;
+    }
+
+    FILE* file = fopen(output_path, "wb");
+    if (!file) {
+        printf("Failed to open output file.\n");
+        return 1;
+    }
+    FusionRun run = {list, poses, options, raw_depth, splatinit_encoder_create(options, file),
+                     PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0, 0, 0, 0};
+    pthread_t* workers = (pthread_t*)malloc(num_workers * sizeof(pthread_t));
+    int* started = (int*)calloc(num_workers, sizeof(int));
+    if (!workers || !started || !run.encoder) {
+        free(workers);
+        free(started);
+        if (run.encoder) {
+            splatinit_encoder_finish(run.encoder, NULL);
+        }
+        fclose(file);
+        printf("Failed to allocate memory for the views.\n");
+        return 1;
+    }
+
+    double start_time = wall_time_seconds();
+    for (int w = 1; w < num_workers; w++) {
+        started[w] = pthread_create(&workers[w], NULL, fusion_worker, &run) == 0;
+    }
+    fusion_worker(&run);
+    for (int w = 1; w < num_workers; w++) {
+        if (started[w]) {
+            pthread_join(workers[w], NULL);
+        }
+    }
+    free(started);
+    free(workers);
+
+    // Patches the vertex count, a placeholder until every view is written, or writes out the compressed file
+    long long bytes_written = splatinit_encoder_finish(run.encoder, NULL);
+    if (fclose(file) != 0 || bytes_written < 0) {
+        printf("Failed to write output file.\n");
+        return 1;
+    }
+    double seconds = wall_time_seconds() - start_time;
+
+    printf("Fused %d of %d views into %lld splats on %d workers\n", run.num_converted, list->num_items,
+           run.num_splats, num_workers);
+    printf("Output file: %s\n", output_path);
+    print_batch_throughput(run.num_converted, bytes_written, seconds);
+    return run.num_converted == list->num_items ? 0 : 1;
 }
 
 void print_help() {
     printf("Usage: splatinit [options] <image_path> [depth_map_path]\n");
+    printf("       splatinit [options] --batch <list_file|directory|pattern>\n");
+    printf("       splatinit [options] --sequence <frame_pattern> [--depth-sequence <depth_pattern>]\n");
+    printf("       splatinit [options] --views <view_list>\n");
     printf("Description: splatinit.c loops over an image and creates a single unoptimized 3D Gaussian Splat per pixel. The output is a .ply file that is in a compatible format produced in the '3D Gaussian Splatting for Real-Time Radiance Field Rendering' project. There are no optimizations or Spherical Harmonics that provide any view-dependent colors.\n");
     printf("Options:\n");
     printf("  -h, --help       Show this help message and exit\n");
-    printf("  -o, --output     Specify the output file path\n");
+    printf("  -o, --output     Specify the output file path, or the output directory in batch and sequence mode. Every frame of an animated GIF is written to the path numbered, such as output_00000.ply\n");
+    printf("  -t, --threads N  Number of threads used to generate splats (default: number of online CPUs, 1 in batch, sequence and multi-view mode)\n");
+    printf("  -s, --stream     Generate and write splats band by band so memory stays proportional to the width\n");
+    printf("  -b, --band-rows N  Rows per band in streaming mode, implies --stream (default: %d)\n", DEFAULT_STREAM_BAND_ROWS);
+    printf("  -m, --mmap-output  Generate splats directly into the memory mapped output file\n");
+    printf("  -c, --coalesce MODE  How adjacent splats are merged: none, rect (identical colors, default) or quadtree\n");
+    printf("  -e, --tolerance E  Largest per-channel standard deviation, in 8-bit levels, of a quadtree block (default: 0)\n");
+    printf("  -d, --depth-tolerance D  Largest depth spread of a merged splat; the standard deviation for quadtree blocks (default: 0)\n");
+    printf("  -k, --color-kernel NAME  RGB to SH conversion kernel: auto (fastest, default), scalar, lut, sse2 or avx2\n");
+    printf("  -B, --benchmark  Time the color kernels on the image and exit\n");
+    printf("  -l, --batch PATH  Convert every image of a list file (image and optional depth map per line), a directory or a quoted glob pattern, each into <name>.ply in the output directory\n");
+    printf("  -j, --jobs N     Number of images converted concurrently in batch, sequence and multi-view mode (default: number of online CPUs)\n");
+    printf("  -S, --sequence PATTERN  Convert a numbered frame sequence such as frame_%%05d.png, each frame into <name>.ply in the output directory, like a batch\n");
+    printf("  -D, --depth-sequence PATTERN  Depth map of every frame of the sequence, such as depth_%%05d.png\n");
+    printf("  -f, --first-frame N  First frame number of the sequence (default: 0 or 1, whichever exists)\n");
+    printf("  -L, --last-frame N  Last frame number of the sequence (default: the frame before the first missing one)\n");
+    printf("  -p, --pipeline   In batch and sequence mode and for animated GIFs, decode, convert and write consecutive images concurrently in a three-stage pipeline instead of on a worker pool\n");
+    printf("  -T, --delta      In batch and sequence mode and for animated GIFs, write only the splats of pixels that changed since the previous image, between keyframes; implies --pipeline\n");
+    printf("  -K, --keyframe-interval N  Images from one keyframe to the next in delta mode (default: %d)\n", DEFAULT_KEYFRAME_INTERVAL);
+    printf("  --pipeline-frames N  Images in flight in the pipeline, each holding its decoded image and all its splats (default: %d)\n", DEFAULT_PIPELINE_FRAMES);
+    printf("  -R, --depth-raw W,H,TYPE  Depth maps are headerless files of W x H little-endian float32, uint16 or uint8 samples, read in place through a memory mapping. .npy depth maps are always read this way\n");
+    printf("  --fx F, --fy F   Focal lengths in pixels; with either, splats are unprojected through a pinhole camera into camera space using the depth map (default: positions in pixels)\n");
+    printf("  --cx X, --cy Y   Principal point in pixels (default: the center of the image)\n");
+    printf("  -V, --views PATH  Fuse the views of a capture, listed one per line as an image, its depth map and its 3x4 camera to world pose in row-major order, into one PLY file in world space, converting views concurrently as in batch mode\n");
+    printf("  --format FORMAT  Output file format: ply (14 floats per splat, default), compressed-ply (the PlayCanvas and SuperSplat chunked format, 16 bytes per splat) or splat (the headerless .splat format of web viewers, 32 bytes per splat, written to output.splat by default and to <name>.splat in batch and sequence mode)\n");
+    printf("  --precision P    Precision of the colors, opacities, rotations and scales of ply output: float (default) or half, 34 instead of 56 bytes per splat\n");
 }
 
 int main(int argc, char* argv[]) {
     char output_path[256];
     sprintf(output_path, "%s%s", OUTPUT_DIR, OUTPUT_PLY_NAME);
+    SplatinitOptions options;
+    splatinit_default_options(&options);
+    int mmap_output = 0;
+    int benchmark = 0;
+    const char* batch_path = NULL;
+    const char* batch_output_dir = OUTPUT_DIR;
+    int output_given = 0;
+    int num_jobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int threads_given = 0;
+    int pipeline = 0;
+    const char* sequence_pattern = NULL;
+    const char* depth_sequence_pattern = NULL;
+    int first_frame = -1;
+    int last_frame = -1;
+    int delta = 0;
+    int keyframe_interval = DEFAULT_KEYFRAME_INTERVAL;
+    int pipeline_frames = DEFAULT_PIPELINE_FRAMES;
+    RawDepthLayout raw_depth_layout;
+    const RawDepthLayout* raw_depth = NULL;
+    char raw_depth_type[16];
+    const char* views_path = NULL;
 
     int opt;
     static struct option long_options[] = {
             {"help", no_argument, 0, 'h'},
             {"output", required_argument, 0, 'o'},
+            {"threads", required_argument, 0, 't'},
+            {"stream", no_argument, 0, 's'},
+            {"band-rows", required_argument, 0, 'b'},
+            {"mmap-output", no_argument, 0, 'm'},
+            {"coalesce", required_argument, 0, 'c'},
+            {"tolerance", required_argument, 0, 'e'},
+            {"depth-tolerance", required_argument, 0, 'd'},
+            {"color-kernel", required_argument, 0, 'k'},
+            {"benchmark", no_argument, 0, 'B'},
+            {"batch", required_argument, 0, 'l'},
+            {"jobs", required_argument, 0, 'j'},
+            {"pipeline", no_argument, 0, 'p'},
+            {"sequence", required_argument, 0, 'S'},
+            {"depth-sequence", required_argument, 0, 'D'},
+            {"first-frame", required_argument, 0, 'f'},
+            {"last-frame", required_argument, 0, 'L'},
+            {"delta", no_argument, 0, 'T'},
+            {"keyframe-interval", required_argument, 0, 'K'},
+            {"depth-raw", required_argument, 0, 'R'},
+            {"fx", required_argument, 0, OPTION_FX},
+            {"fy", required_argument, 0, OPTION_FY},
+            {"cx", required_argument, 0, OPTION_CX},
+            {"cy", required_argument, 0, OPTION_CY},
+            {"views", required_argument, 0, 'V'},
+            {"format", required_argument, 0, OPTION_FORMAT},
+            {"precision", required_argument, 0, OPTION_PRECISION},
+            {"pipeline-frames", required_argument, 0, OPTION_PIPELINE_FRAMES},
             {0, 0, 0, 0}
     };
 
-    while ((opt = getopt_long(argc, argv, "ho:", long_options, NULL)) != -1) {
+    while ((opt = getopt_long(argc, argv, "ho:t:sb:mc:e:d:k:Bl:j:pS:D:f:L:TK:R:V:", long_options, NULL)) != -1) {
         switch (opt) {
             case 'h':
                 print_help();
                 return 0;
             case 'o':
                 strcpy(output_path, optarg);
+                batch_output_dir = optarg;
+                output_given = 1;
+                break;
+            case 't':
+                options.num_threads = atoi(optarg);
+                if (options.num_threads < 1) {
+                    printf("Invalid thread count: %s\n", optarg);
+                    return 1;
+                }
+                threads_given = 1;
+                break;
+            case 's':
+                if (options.band_rows == 0) {
+                    options.band_rows = DEFAULT_STREAM_BAND_ROWS;
+                }
+                break;
+            case 'b':
+                options.band_rows = atoi(optarg);
+                if (options.band_rows < 1) {
+                    printf("Invalid band row count: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'm':
+                mmap_output = 1;
+                break;
+            case 'c':
+                if (strcmp(optarg, "none") == 0) {
+                    options.coalesce.mode = COALESCE_NONE;
+                } else if (strcmp(optarg, "rect") == 0) {
+                    options.coalesce.mode = COALESCE_RECT;
+                } else if (strcmp(optarg, "quadtree") == 0) {
+                    options.coalesce.mode = COALESCE_QUADTREE;
+                } else {
+                    printf("Unknown coalescing mode: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'e':
+                options.coalesce.tolerance = (float)atof(optarg);
+                if (options.coalesce.tolerance < 0.0f) {
+                    printf("Invalid tolerance: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'k':
+                options.color_kernel = optarg;
+                break;
+            case 'B':
+                benchmark = 1;
+                break;
+            case 'l':
+                batch_path = optarg;
+                break;
+            case 'j':
+                num_jobs = atoi(optarg);
+                if (num_jobs < 1) {
+                    printf("Invalid job count: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'p':
+                pipeline = 1;
+                break;
+            case 'S':
+                sequence_pattern = optarg;
+                break;
+            case 'D':
+                depth_sequence_pattern = optarg;
+                break;
+            case 'f':
+                first_frame = atoi(optarg);
+                if (first_frame < 0) {
+                    printf("Invalid first frame: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'L':
+                last_frame = atoi(optarg);
+                if (last_frame < 0) {
+                    printf("Invalid last frame: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'T':
+                delta = 1;
+                pipeline = 1;
+                break;
+            case 'K':
+                keyframe_interval = atoi(optarg);
+                if (keyframe_interval < 1) {
+                    printf("Invalid keyframe interval: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'R':
+                if (sscanf(optarg, "%d,%d,%15s", &raw_depth_layout.width, &raw_depth_layout.height,
+                           raw_depth_type) != 3 || raw_depth_layout.width < 1 || raw_depth_layout.height < 1) {
+                    printf("Invalid raw depth layout: %s\n", optarg);
+                    return 1;
+                }
+                if (strcmp(raw_depth_type, "float32") == 0) {
+                    raw_depth_layout.format = DEPTH_F32;
+                } else if (strcmp(raw_depth_type, "uint16") == 0) {
+                    raw_depth_layout.format = DEPTH_U16;
+                } else if (strcmp(raw_depth_type, "uint8") == 0) {
+                    raw_depth_layout.format = DEPTH_U8;
+                } else {
+                    printf("Unknown raw depth type: %s\n", raw_depth_type);
+                    return 1;
+                }
+                raw_depth = &raw_depth_layout;
+                break;
+            case 'V':
+                views_path = optarg;
+                break;
+            case OPTION_FX:
+            case OPTION_FY:
+                if (atof(optarg) <= 0.0) {
+                    printf("Invalid focal length: %s\n", optarg);
+                    return 1;
+                }
+                *(opt == OPTION_FX ? &options.camera.fx : &options.camera.fy) = (float)atof(optarg);
+                break;
+            case OPTION_CX:
+                options.camera.cx = (float)atof(optarg);
+                break;
+            case OPTION_CY:
+                options.camera.cy = (float)atof(optarg);
+                break;
+            case OPTION_FORMAT:
+                if (strcmp(optarg, "ply") == 0) {
+                    options.format = FORMAT_PLY;
+                } else if (strcmp(optarg, "compressed-ply") == 0) {
+                    options.format = FORMAT_COMPRESSED_PLY;
+                } else if (strcmp(optarg, "splat") == 0) {
+                    options.format = FORMAT_SPLAT;
+                } else {
+                    printf("Unknown output format: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case OPTION_PRECISION:
+                if (strcmp(optarg, "float") == 0) {
+                    options.precision = PRECISION_FLOAT;
+                } else if (strcmp(optarg, "half") == 0) {
+                    options.precision = PRECISION_HALF;
+                } else {
+                    printf("Unknown precision: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case OPTION_PIPELINE_FRAMES:
+                pipeline_frames = atoi(optarg);
+                if (pipeline_frames < 1) {
+                    printf("Invalid pipeline frame count: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'd':
+                options.coalesce.depth_tolerance = (float)atof(optarg);
+                if (options.coalesce.depth_tolerance < 0.0f) {
+                    printf("Invalid depth tolerance: %s\n", optarg);
+                    return 1;
+                }
                 break;
             default:
                 print_help();
@@ -97,143 +1469,177 @@ int main(int argc, char* argv[]) {
         }
     }
 
-    if (optind >= argc || optind + 2 < argc) {
+    int many_images = batch_path || sequence_pattern || views_path;
+    // An animated GIF is converted like a sequence of its frames, so it can go through the pipeline too
+    int animation = !many_images && !benchmark && optind < argc && is_gif(argv[optind]);
+    int usage_error = many_images ? optind < argc || benchmark || !batch_path + !sequence_pattern + !views_path < 2
+                                  : optind >= argc || optind + 2 < argc || (pipeline && !animation);
+    if (usage_error || (depth_sequence_pattern && !sequence_pattern)) {
         print_help();
         return 1;
     }
 
-    const char* image_path = argv[optind];
-    const char* depth_map_path = (optind + 1 < argc) ? argv[optind + 1] : NULL;
+    // A single focal length is taken for square pixels
+    options.camera.fx = options.camera.fx > 0.0f ? options.camera.fx : options.camera.fy;
+    options.camera.fy = options.camera.fy > 0.0f ? options.camera.fy : options.camera.fx;
+    if (options.camera.fx > 0.0f && !many_images && optind + 1 >= argc) {
+        printf("Unprojecting through --fx and --fy needs a depth map.\n");
+        return 1;
+    }
 
-    clock_t start_time = clock();
+    if (!splatinit_color_kernel_supported(options.color_kernel)) {
+        printf("Unknown or unsupported color kernel: %s\n", options.color_kernel);
+        return 1;
+    }
 
-    int width, height, channels;
-    unsigned char* image_data = stbi_load(image_path, &width, &height, &channels, 3);
-    if (!image_data) {
-        printf("Failed to load image.\n");
+    if (mmap_output && options.band_rows > 0) {
+        printf("--mmap-output cannot be combined with --stream.\n");
         return 1;
     }
 
-    int depth_width = 0, depth_height = 0, depth_channels = 0;
-    unsigned char* depth_data = NULL;
-    if (depth_map_path != NULL) {
-        depth_data = stbi_load(depth_map_path, &depth_width, &depth_height, &depth_channels, 1);
-        if (!depth_data || depth_width != width || depth_height != height) {
-            printf("Failed to load depth map or dimensions mismatch.\n");
-            stbi_image_free(image_data);
-            return 1;
-        }
-        printf("Using depth information.\n");
+    if (pipeline && mmap_output) {
+        printf("--mmap-output cannot be combined with --pipeline.\n");
+        return 1;
+    }
+
+    if (options.precision != PRECISION_FLOAT && options.format != FORMAT_PLY) {
+        printf("--precision only applies to --format ply.\n");
+        return 1;
     }
 
-    int num_splats = width * height;
-    Splat* splats = (Splat*)malloc(num_splats * sizeof(Splat));
+    if (mmap_output && (options.format != FORMAT_PLY || options.precision != PRECISION_FLOAT)) {
+        printf("--mmap-output only writes --format ply in float precision.\n");
+        return 1;
+    }
 
-    for (int y = 0; y < height; y++) {
-        for (int x = 0; x < width; x++) {
-            int index = y * width + x;
-            splats[index].packed_position[0] = (float)x;
-            splats[index].packed_position[1] = (float)y;
+    if (views_path && (pipeline || mmap_output)) {
+        printf("--views cannot be combined with --pipeline or --mmap-output.\n");
+        return 1;
+    }
 
-            if (depth_data) {
-                float depth = depth_data[index];
-                splats[index].packed_position[2] = depth;
-            } else {
-                splats[index].packed_position[2] = FLAT ? 0.0f : 0.0f;
-            }
+    if (!output_given && options.format == FORMAT_SPLAT) {
+        sprintf(output_path, "%s%s", OUTPUT_DIR, OUTPUT_SPLAT_NAME);
+    }
 
-            float rgb[3];
-            for (int c = 0; c < 3; c++) {
-                rgb[c] = image_data[(y * width + x) * 3 + c] / 255.0f;
+    if (many_images || animation) {
+        // The worker pool converts images in parallel, so each one is generated on a single thread unless
+        // asked otherwise. The pipeline has a single converter that keeps every thread, and so does the
+        // single worker converting the frames of an animation.
+        if (!threads_given && !pipeline && !animation) {
+            options.num_threads = 1;
+        }
+        BatchList list = {NULL, 0, 0};
+        CameraPose* poses = NULL;
+        const char* extension = options.format == FORMAT_SPLAT ? ".splat" : ".ply";
+        int result;
+        if (animation) {
+            result = batch_list_add(&list, argv[optind], optind + 1 < argc ? argv[optind + 1] : NULL, output_path);
+            if (result != 0) {
+                printf("Failed to allocate memory for the batch.\n");
             }
-            rgb2_sh(rgb, splats[index].packed_color);
-
-            splats[index].opacity = 1.0f;
-            splats[index].packed_rotation[0] = 1.0f;
-            splats[index].packed_rotation[1] = 1.0f;
-            splats[index].packed_rotation[2] = 0.0f;
-            splats[index].packed_rotation[3] = 0.0f;
-            splats[index].packed_scale[0] = 0.1f;
-            splats[index].packed_scale[1] = 0.1f;
-            splats[index].packed_scale[2] = 0.1f;
+            num_jobs = 1;
+        } else if (batch_path) {
+            result = read_batch_list(batch_path, batch_output_dir, extension, &list);
+        } else if (views_path) {
+            result = read_view_list(views_path, output_path, &list, &poses);
+        } else {
+            result = read_sequence_list(sequence_pattern, depth_sequence_pattern, first_frame, last_frame,
+                                        batch_output_dir, extension, &list);
         }
+        for (int i = 0; result == 0 && options.camera.fx > 0.0f && i < list.num_items; i++) {
+            if (!list.items[i].depth_map_path) {
+                printf("Unprojecting %s through --fx and --fy needs a depth map.\n", list.items[i].image_path);
+                result = -1;
+            }
+        }
+        if (result == 0 && views_path) {
+            result = run_fusion(&list, poses, &options, raw_depth, output_path, num_jobs);
+        } else if (result == 0) {
+            result = pipeline ? run_pipeline(&list, &options, raw_depth, pipeline_frames, delta ? keyframe_interval : 0)
+                              : run_batch(&list, &options, raw_depth, mmap_output, num_jobs);
+        }
+        free(poses);
+        batch_list_free(&list);
+        return result == 0 ? 0 : 1;
     }
 
-    int coalesced_num_splats = num_splats;
-
-    if (!depth_data) {
-        // Coalesce adjacent splats of the same color only if there's no depth map
-        for (int y = 0; y < height; y++) {
-            for (int x = 0; x < width; x++) {
-                int index = y * width + x;
-                Splat* current = &splats[index];
+    const char* image_path = argv[optind];
+    const char* depth_map_path = (optind + 1 < argc) ? argv[optind + 1] : NULL;
 
-                if (current->opacity == 0.0f) {
-                    continue; // Skip already coalesced splats
-                }
+    double start_time = wall_time_seconds();
 
-                // Check the right neighbor
-                if (x < width - 1) {
-                    Splat* right = &splats[index + 1];
-                    if (memcmp(current->packed_color, right->packed_color, sizeof(float) * 3) == 0) {
-                        // Colors match, coalesce the splats
-                        current->packed_position[0] = (current->packed_position[0] + right->packed_position[0]) / 2.0f;
-                        current->packed_scale[0] *= 2.0f;
-                        right->opacity = 0.0f; // Mark the right splat as coalesced
-                    }
-                }
+    int width, height, channels;
+    unsigned char* image_data = stbi_load(image_path, &width, &height, &channels, 3);
+    if (!image_data) {
+        printf("Failed to load image.\n");
+        return 1;
+    }
 
-                // Check the bottom neighbor
-                if (y < height - 1) {
-                    Splat* bottom = &splats[index + width];
-                    if (memcmp(current->packed_color, bottom->packed_color, sizeof(float) * 3) == 0) {
-                        // Colors match, coalesce the splats
-                        current->packed_position[1] = (current->packed_position[1] + bottom->packed_position[1]) / 2.0f;
-                        current->packed_scale[1] *= 2.0f;
-                        bottom->opacity = 0.0f; // Mark the bottom splat as coalesced
-                    }
-                }
-            }
-        }
+    if (benchmark) {
+        splatinit_benchmark_color_kernels(image_data, width * height);
+        stbi_image_free(image_data);
+        return 0;
+    }
 
-        // Count the number of remaining splats after coalescing
-        coalesced_num_splats = 0;
-        for (int i = 0; i < num_splats; i++) {
-            if (splats[i].opacity != 0.0f) {
-                coalesced_num_splats++;
-            }
+    DecodedImage image = {image_data, NULL, DEPTH_U8, NULL, 0, width, height, 1, NULL};
+    if (depth_map_path != NULL) {
+        if (load_depth_map(depth_map_path, raw_depth, &image) != 0) {
+            printf("Failed to load depth map or dimensions mismatch.\n");
+            decoded_image_free(&image);
+            return 1;
         }
+        options.depth_format = image.depth_format;
+        printf("Using depth information.\n");
     }
+    void* depth_data = image.depth_data;
 
-    FILE* file = fopen(output_path, "wb");
+    FILE* file = fopen(output_path, mmap_output ? "w+b" : "wb");
     if (!file) {
         printf("Failed to open output file.\n");
-        free(splats);
-        stbi_image_free(image_data);
-        if (depth_data) {
-            stbi_image_free(depth_data);
-        }
+        decoded_image_free(&image);
         return 1;
     }
 
-    int bytes_written = encode_splats_play_canvas_format(splats, num_splats, coalesced_num_splats, file);
-    fclose(file);
+    SplatinitContext* context = splatinit_create();
+    int num_splats = 0;
+    long long bytes_written = -1;
+    double write_start = wall_time_seconds();
+
+    if (!context) {
+        printf("Failed to allocate memory for splats.\n");
+    } else if (options.band_rows > 0) {
+        bytes_written = splatinit_write_ply(context, image_data, depth_data, width, height, &options, file,
+                                            &num_splats);
+        printf("Streamed %d splats in bands of %d rows\n", num_splats, options.band_rows);
+    } else if (mmap_output) {
+        bytes_written = splatinit_write_ply_mapped(context, image_data, depth_data, width, height, &options, file,
+                                                   &num_splats);
+        printf("Generated %d splats into the mapped output file\n", num_splats);
+    } else {
+        bytes_written = splatinit_write_ply(context, image_data, depth_data, width, height, &options, file,
+                                            &num_splats);
+        printf("Converted %d pixels into %d splats on %d threads in %.3f seconds\n", width * height, num_splats,
+               options.num_threads < height ? options.num_threads : height, wall_time_seconds() - write_start);
+    }
+    splatinit_destroy(context);
+
+    if (fclose(file) != 0 || bytes_written < 0) {
+        printf("Failed to write output file.\n");
+        decoded_image_free(&image);
+        return 1;
+    }
+    double write_time = wall_time_seconds() - write_start;
 
     printf("Output file: %s\n", output_path);
-    printf("Bytes written: %d\n", bytes_written);
+    printf("Bytes written: %lld\n", bytes_written);
+    printf("Write throughput: %.1f MB/s\n", write_time > 0.0 ? bytes_written / write_time / 1e6 : 0.0);
     printf("Original image size: %d bytes\n", width * height * channels);
     printf("Bytes per original byte: %.2f\n", (float)bytes_written / (width * height * channels));
 
-    clock_t end_time = clock();
-    double execution_time = (double)(end_time - start_time) / CLOCKS_PER_SEC;
+    double execution_time = wall_time_seconds() - start_time;
     printf("Execution time: %.2f seconds\n", execution_time);
     printf("Execution time over 1hz: %.2f times\n", execution_time / 0.01667);
 
-    free(splats);
-    stbi_image_free(image_data);
-    if (depth_data) {
-        stbi_image_free(depth_data);
-    }
-
+    decoded_image_free(&image);
     return 0;
 }
\ No newline at end of file
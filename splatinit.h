@@ -0,0 +1,161 @@
+//
+// Public interface of libsplatinit, the image to Gaussian splat conversion behind the splatinit executable.
+//
+#ifndef SPLATINIT_H
+#define SPLATINIT_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// One splat, laid out exactly like a vertex of the PLY output
+typedef struct {
+    float packed_position[3];
+    float packed_color[3];
+    float opacity;
+    float packed_rotation[4];
+    float packed_scale[3];
+} Splat;
+
+typedef enum {
+    COALESCE_NONE,
+    COALESCE_RECT,
+    COALESCE_QUADTREE
+} CoalesceMode;
+
+typedef struct {
+    CoalesceMode mode;
+    float tolerance;       // Largest per-channel color standard deviation of a quadtree block, in 8-bit levels
+    float depth_tolerance; // Largest depth spread of a merged splat, in depth units
+} CoalesceOptions;
+
+// Sample type of a depth map
+typedef enum {
+    DEPTH_U8,  // 8-bit, one depth unit per level
+    DEPTH_U16, // 16-bit, scaled so that 65535 is 255 depth units
+    DEPTH_F32  // float, in depth units
+} DepthFormat;
+
+// Pinhole camera intrinsics, in pixels. With a focal length set, splats are unprojected from their pixel
+// (u, v) and depth z into camera space: ((u - cx) * z / fx, (v - cy) * z / fy, z), and their footprint
+// scaled to match. A NAN cx or cy stands for the center of the image.
+typedef struct {
+    float fx;
+    float fy;
+    float cx;
+    float cy;
+} CameraIntrinsics;
+
+// Rigid transform from camera space, or from pixel coordinates without intrinsics, into the world:
+// world = rotation * camera + translation. Splat orientations are rotated along.
+typedef struct {
+    float rotation[3][3]; // Row major
+    float translation[3];
+} CameraPose;
+
+// File format splats are written in
+typedef enum {
+    FORMAT_PLY,            // 14 floats per splat, the layout of the 3D Gaussian Splatting project
+    FORMAT_COMPRESSED_PLY, // The PlayCanvas and SuperSplat compressed PLY, 16 bytes per splat quantized
+                           // against the bounds of chunks of 256 consecutive splats
+    FORMAT_SPLAT           // The headerless .splat format of web viewers, 32 bytes per splat: position and
+                           // linear scale as floats, RGBA8 color and the rotation in 8 bits per component
+} OutputFormat;
+
+// Precision of the fields of FORMAT_PLY files. Positions stay in full precision, as half precision would
+// not keep whole pixels apart beyond 2048.
+typedef enum {
+    PRECISION_FLOAT,
+    PRECISION_HALF // Colors, opacity, rotation and scale as float16, 34 bytes per splat
+} SplatPrecision;
+
+typedef struct {
+    CoalesceOptions coalesce;
+    int num_threads;          // Threads the splats of a band are generated on
+    int band_rows;            // Rows generated and coalesced at a time; 0 converts the whole image at once
+    const char* color_kernel; // RGB to SH kernel: auto, scalar, lut, sse2 or avx2
+    const char* comments;     // Lines written as comments into PLY headers, NULL for none; about 3 KB fit
+    DepthFormat depth_format; // Of the depth maps passed in, one sample per pixel
+    CameraIntrinsics camera;  // fx and fy of 0 keep positions in pixels
+    const CameraPose* pose;   // NULL leaves splats in camera space
+    OutputFormat format;      // Of the files written
+    SplatPrecision precision; // Of FORMAT_PLY files
+} SplatinitOptions;
+
+// Rect coalescing on every online CPU, the whole image at once, with the fastest color kernel, no
+// comments, 8-bit depth maps, positions in pixels, no pose and full precision PLY files
+void splatinit_default_options(SplatinitOptions* options);
+
+// Receives the splats of a conversion in order, a chunk at a time
+typedef struct {
+    // Optional. Called once before the first splat with the number of splats, or -1 when the image is
+    // converted in bands and the count is only known once splatinit_convert() returns.
+    int (*begin)(void* user_data, int num_splats);
+    int (*write)(void* user_data, const Splat* splats, int count);
+    void* user_data;
+} SplatinitSink;
+
+// Holds the splat, staging and coalescing buffers across conversions, so converting a stream of images
+// allocates only when an image is larger than the ones before it. A context must not be used by two
+// threads at once; use one context per thread.
+typedef struct SplatinitContext SplatinitContext;
+
+SplatinitContext* splatinit_create(void);
+void splatinit_destroy(SplatinitContext* context);
+
+// Converts a width x height 8-bit RGB image, with an optional depth map of options->depth_format samples,
+// into splats and passes them to the sink. Returns the number of splats, or -1 when out of memory, when
+// the color kernel is unknown or when a sink callback returns non-zero.
+int splatinit_convert(SplatinitContext* context, const uint8_t* rgb, const void* depth, int width, int height,
+                      const SplatinitOptions* options, const SplatinitSink* sink);
+
+// Converts a frame of a sequence as a delta against the previous frame: only the splats of pixels whose
+// color, or depth when both frames have a depth map, differ from the previous frame are passed to the
+// sink, and coalesced splats never cover an unchanged pixel. Returns the number of splats or -1.
+int splatinit_convert_delta(SplatinitContext* context, const uint8_t* rgb, const void* depth,
+                            const uint8_t* previous_rgb, const void* previous_depth, int width, int height,
+                            const SplatinitOptions* options, const SplatinitSink* sink);
+
+// Writes splats into a file in options->format, with options->comments in its header if it has one, as
+// they arrive. Splats of several conversions, or converted earlier, can be written into a single file this
+// way. The encoder keeps pointers to the comments and the file.
+typedef struct SplatinitEncoder SplatinitEncoder;
+
+// Starts a file at the current position of file. Returns NULL when out of memory.
+SplatinitEncoder* splatinit_encoder_create(const SplatinitOptions* options, FILE* file);
+
+// Sink that passes a conversion's splats to the encoder. Its begin may only be called before the first
+// splat; a PLY file started without a count, or with -1, gets a zero padded vertex count patched once
+// the encoder finishes, so file must then be seekable.
+const SplatinitSink* splatinit_encoder_sink(SplatinitEncoder* encoder);
+
+// Appends splats. Returns 0, or -1 once writing failed.
+int splatinit_encoder_write(SplatinitEncoder* encoder, const Splat* splats, int count);
+
+// Completes the file: patches the vertex count, or writes out the compressed chunks, which are only
+// complete once every splat is known. Stores the number of splats in num_splats unless it is NULL, frees
+// the encoder and returns the number of bytes written, or -1.
+long long splatinit_encoder_finish(SplatinitEncoder* encoder, int* num_splats);
+
+// Converts the image into a file in options->format written from the current position of file, through
+// an encoder. Stores the number of splats in num_splats and returns the number of bytes written, or -1.
+long long splatinit_write_ply(SplatinitContext* context, const uint8_t* rgb, const void* depth, int width,
+                              int height, const SplatinitOptions* options, FILE* file, int* num_splats);
+
+// Same, but sizes the empty file, opened for reading and writing, for one splat per pixel and generates
+// the splats directly into a memory mapping of it, then truncates it to its final size. Only writes
+// full precision FORMAT_PLY files, the one layout the splats are generated in.
+long long splatinit_write_ply_mapped(SplatinitContext* context, const uint8_t* rgb, const void* depth,
+                                     int width, int height, const SplatinitOptions* options, FILE* file,
+                                     int* num_splats);
+
+// Writes splats that were already converted, for instance collected through a sink, as a file in
+// options->format with options->comments in its header. Returns the number of bytes written or -1.
+long long splatinit_encode_ply(const Splat* splats, int num_splats, const SplatinitOptions* options, FILE* file);
+
+// Whether the color kernel name is known and runs on this CPU; "auto" always does
+int splatinit_color_kernel_supported(const char* name);
+
+// Times every supported color kernel over the pixels against the scalar path and prints the results
+void splatinit_benchmark_color_kernels(const uint8_t* rgb, int num_pixels);
+
+#endif // SPLATINIT_H